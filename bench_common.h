@@ -0,0 +1,51 @@
+#pragma once
+
+// Pieces shared by the KKIndex benchmarks: timing, the generated key column,
+// the optional trailing viewport arguments, and keeping stdout for the CSV
+// while the index logs go to stderr.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+inline double elapsedMs(std::chrono::high_resolution_clock::time_point startTime)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    return elapsed.count();
+}
+
+// numRows keys, uniform over [0, numRows * 2), so about half of the domain
+// positions are empty
+inline std::vector<int> generateUniformKeys(int numRows, std::mt19937 &random)
+{
+    std::vector<int> keys(numRows);
+    for (int &key : keys)
+    {
+        key = std::uniform_int_distribution<int>(0, 2 * numRows - 1)(random);
+    }
+    return keys;
+}
+
+// Reads "viewport_width viewport_height" from argv[first] and argv[first + 1]
+// if both are given, else keeps 1024 x 1024. Returns false on a size that is
+// not positive.
+inline bool parseViewportArguments(int argc, char **argv, int first, int &width, int &height)
+{
+    width = argc > first + 1 ? std::atoi(argv[first]) : 1024;
+    height = argc > first + 1 ? std::atoi(argv[first + 1]) : 1024;
+    if (width <= 0 || height <= 0)
+    {
+        std::cerr << "Invalid viewport " << width << " x " << height << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Sends std::cout, where the index logs, to stderr and returns the original
+// stdout buffer, which then only carries the CSV
+inline std::streambuf *redirectLogToStderr()
+{
+    return std::cout.rdbuf(std::cerr.rdbuf());
+}
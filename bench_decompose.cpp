@@ -0,0 +1,111 @@
+// Benchmarks query decomposition across batch sizes: the sweep-line
+// decomposeQueries() against the previous per-interval scan over all queries
+// with a std::set per subquery. Queries are drawn like
+// tpch_1GB/queries.py --overlapping.
+//
+// Usage: bench_decompose [max_queries] [max_key]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "query_decomposition.h"
+
+struct ScanSubquery
+{
+    int start;
+    int end;
+    std::set<int> originalQueries;
+};
+
+// The O(E * Q) decomposition decomposeQueries() replaced
+std::vector<ScanSubquery> decomposeQueriesScan(const std::vector<std::pair<int, int>> &queries)
+{
+    std::vector<int> endpoints;
+    for (const auto &query : queries)
+    {
+        endpoints.push_back(query.first);
+        endpoints.push_back(query.second);
+    }
+    std::sort(endpoints.begin(), endpoints.end());
+    endpoints.erase(std::unique(endpoints.begin(), endpoints.end()), endpoints.end());
+
+    std::vector<ScanSubquery> subqueries;
+    for (size_t i = 0; i + 1 < endpoints.size(); ++i)
+    {
+        ScanSubquery subquery;
+        subquery.start = endpoints[i];
+        subquery.end = endpoints[i + 1];
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            if (queries[q].first < subquery.end && queries[q].second > subquery.start)
+            {
+                subquery.originalQueries.insert(q);
+            }
+        }
+        if (!subquery.originalQueries.empty())
+        {
+            subqueries.push_back(subquery);
+        }
+    }
+    return subqueries;
+}
+
+bool sameDecomposition(const QueryDecomposition &sweep, const std::vector<ScanSubquery> &scan)
+{
+    if (sweep.subqueries.size() != scan.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < scan.size(); ++i)
+    {
+        if (sweep.subqueries[i].start != scan[i].start || sweep.subqueries[i].end != scan[i].end ||
+            !std::equal(sweep.membersBegin(i), sweep.membersEnd(i), scan[i].originalQueries.begin(), scan[i].originalQueries.end()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int maxQueries = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int maxKey = argc > 2 ? std::atoi(argv[2]) : 6000000;
+
+    std::mt19937 random(42);
+    std::cout << "queries,subqueries,memberships,sweep_ms,scan_ms,speedup" << std::endl;
+    for (int numQueries = 10; numQueries <= maxQueries; numQueries *= 10)
+    {
+        std::vector<std::pair<int, int>> queries;
+        for (int q = 0; q < numQueries; ++q)
+        {
+            int x = std::uniform_int_distribution<int>(0, maxKey - 1)(random);
+            int y = std::uniform_int_distribution<int>(x + 1, maxKey)(random);
+            queries.push_back({x, y});
+        }
+
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+        QueryDecomposition sweep = decomposeQueries(queries);
+        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> sweepElapsed = endTime - startTime;
+
+        startTime = std::chrono::high_resolution_clock::now();
+        std::vector<ScanSubquery> scan = decomposeQueriesScan(queries);
+        endTime = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> scanElapsed = endTime - startTime;
+
+        if (!sameDecomposition(sweep, scan))
+        {
+            std::cerr << "Decompositions differ for " << numQueries << " queries" << std::endl;
+            return -1;
+        }
+        std::cout << numQueries << "," << sweep.subqueries.size() << "," << sweep.members.size() << ","
+                  << sweepElapsed.count() << "," << scanElapsed.count() << ","
+                  << scanElapsed.count() / sweepElapsed.count() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Compares the raster and the compute engine of KKIndex across range sizes.
+// Keys are generated in memory (uniform over [0, numRows * 2), so about half
+// of the domain positions are empty); for every range width a batch of
+// non-overlapping queries is answered by both engines and checked against
+// each other. Prints one CSV line per width with the median query time of
+// each engine.
+//
+// Usage: bench_engines [num_rows] [repetitions] [viewport_width viewport_height]
+// Run from the directory holding shader.vs, shader.fs and shader.comp.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "gl_context.h"
+#include "kk_index.h"
+
+double medianQueryTime(KKIndex &index, const std::vector<std::pair<int, int>> &queries, int repetitions, int &entries)
+{
+    std::vector<double> times;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+        entries = index.query(queries, true);
+        times.push_back(elapsedMs(startTime));
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main(int argc, char **argv)
+{
+    int numRows = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+    int viewportWidth, viewportHeight;
+    if (!parseViewportArguments(argc, argv, 3, viewportWidth, viewportHeight))
+    {
+        return -1;
+    }
+
+    GLContext context;
+    if (!context.createHeadless())
+    {
+        return -1;
+    }
+
+    std::mt19937 random(42);
+    std::vector<int> keys = generateUniformKeys(numRows, random);
+
+    std::streambuf *csv = redirectLogToStderr();
+
+    KKIndex index;
+    index.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+    if (!index.compileComputeShader(loadShaderCode("shader.comp").c_str()))
+    {
+        context.destroy();
+        return -1;
+    }
+    index.setuptFrameBuffersAndViewPort(viewportWidth, viewportHeight, true);
+    if (!index.build(keys.data(), keys.size()))
+    {
+        context.destroy();
+        return -1;
+    }
+
+    std::ostream out(csv);
+    out << "range_width,queries,entries,raster_ms,compute_ms,speedup" << std::endl;
+    const int domain = 2 * numRows;
+    for (int width = 16; width <= domain; width *= 4)
+    {
+        // Up to 64 disjoint ranges of this width spread over the domain
+        int numQueries = std::max(1, std::min(64, domain / width));
+        int stride = domain / numQueries;
+        std::vector<std::pair<int, int>> queries;
+        for (int q = 0; q < numQueries; ++q)
+        {
+            queries.push_back({q * stride, q * stride + width});
+        }
+
+        int rasterEntries = 0, computeEntries = 0;
+        index.engine = QueryEngine::Raster;
+        index.query(queries, true); // Warm-up
+        double rasterTime = medianQueryTime(index, queries, repetitions, rasterEntries);
+        index.engine = QueryEngine::Compute;
+        index.query(queries, true);
+        double computeTime = medianQueryTime(index, queries, repetitions, computeEntries);
+        if (rasterEntries != computeEntries)
+        {
+            std::cerr << "Engines disagree at width " << width << ": " << rasterEntries << " vs " << computeEntries << std::endl;
+            context.destroy();
+            return -1;
+        }
+        out << width << "," << numQueries << "," << rasterEntries << "," << rasterTime << "," << computeTime << ","
+            << rasterTime / computeTime << std::endl;
+    }
+
+    context.destroy();
+    return 0;
+}
@@ -0,0 +1,203 @@
+// End-to-end join of lineitem with orders on orderkey (column 0 of both
+// tables): an index nested-loop join that streams lineitem's orderkeys as
+// probes through a KKIndex on orders, the same join through a CpuIndex, and
+// a CPU hash join (chained, built on orders, probed with lineitem). Every
+// join is checked against the hash join. Prints one CSV line per method
+// with its build and join time.
+//
+// Without the TPC-H tables the bench generates tables of the same shape in
+// memory: 1.5M orders with TPC-H's sparse orderkeys (8 out of every 32) and
+// one to seven lineitems per order.
+//
+// Usage: bench_join [lineitem.tbl orders.tbl] [batch_size] [viewport_width viewport_height]
+// Defaults to tpch_1GB/lineitem.tbl and tpch_1GB/orders.tbl.
+// Run from the directory holding shader.vs and shader.fs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "cpu_index.h"
+#include "gl_context.h"
+#include "kk_index.h"
+#include "table_source.h"
+
+// Chained hash table over the inner keys: head[bucket] is the last inner
+// row of the bucket, next[row] the previous one (-1 ends a chain). Buckets
+// take the high bits of a multiplicative hash; the low bits depend only on
+// the key's low bits, and TPC-H orderkeys use 8 of every 32 values.
+struct HashJoinTable
+{
+    std::vector<int> head;
+    std::vector<int> next;
+    int shift = 32; // 32 - log2(number of buckets)
+
+    unsigned bucket(int key) const
+    {
+        // 64-bit so a shift of 32 (a single bucket) is defined
+        uint64_t hash = static_cast<uint32_t>(static_cast<uint32_t>(key) * 2654435761u);
+        return static_cast<unsigned>(hash >> this->shift);
+    }
+
+    void build(const int *keys, size_t numRows)
+    {
+        size_t numBuckets = 1;
+        this->shift = 32;
+        while (numBuckets < numRows)
+        {
+            numBuckets <<= 1;
+            --this->shift;
+        }
+        this->head.assign(numBuckets, -1);
+        this->next.resize(numRows);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            int &chain = this->head[bucket(keys[row])];
+            this->next[row] = chain;
+            chain = static_cast<int>(row);
+        }
+    }
+
+    std::vector<JoinPair> probe(const int *innerKeys, const int *outerKeys, size_t numOuterRows) const
+    {
+        std::vector<JoinPair> pairs;
+        for (size_t outerRow = 0; outerRow < numOuterRows; ++outerRow)
+        {
+            int key = outerKeys[outerRow];
+            for (int innerRow = this->head[bucket(key)]; innerRow >= 0; innerRow = this->next[innerRow])
+            {
+                if (innerKeys[innerRow] == key)
+                {
+                    pairs.push_back(JoinPair{static_cast<int>(outerRow), innerRow});
+                }
+            }
+        }
+        return pairs;
+    }
+};
+
+bool samePairs(std::vector<JoinPair> a, std::vector<JoinPair> b)
+{
+    auto byRows = [](const JoinPair &x, const JoinPair &y) {
+        return x.outerRow != y.outerRow ? x.outerRow < y.outerRow : x.innerRow < y.innerRow;
+    };
+    std::sort(a.begin(), a.end(), byRows);
+    std::sort(b.begin(), b.end(), byRows);
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](const JoinPair &x, const JoinPair &y) {
+               return x.outerRow == y.outerRow && x.innerRow == y.innerRow;
+           });
+}
+
+// TPC-H shaped orderkeys when the tables are not there
+void generateTables(std::vector<int> &lineitemKeys, std::vector<int> &orderKeys)
+{
+    std::mt19937 random(42);
+    const int numOrders = 1500000;
+    orderKeys.resize(numOrders);
+    for (int i = 0; i < numOrders; ++i)
+    {
+        orderKeys[i] = (i / 8) * 32 + i % 8 + 1;
+    }
+    std::vector<int> shuffled = orderKeys;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    for (int key : shuffled)
+    {
+        int lines = std::uniform_int_distribution<int>(1, 7)(random);
+        lineitemKeys.insert(lineitemKeys.end(), lines, key);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *lineitemFile = argc > 2 ? argv[1] : "tpch_1GB/lineitem.tbl";
+    const char *ordersFile = argc > 2 ? argv[2] : "tpch_1GB/orders.tbl";
+    size_t batchSize = argc > 3 ? std::atoll(argv[3]) : 1 << 20;
+    int viewportWidth, viewportHeight;
+    if (!parseViewportArguments(argc, argv, 4, viewportWidth, viewportHeight))
+    {
+        return -1;
+    }
+
+    GLContext context;
+    if (!context.createHeadless())
+    {
+        return -1;
+    }
+
+    std::streambuf *csv = redirectLogToStderr();
+
+    TableSource lineitem, orders;
+    std::vector<int> generatedLineitem, generatedOrders;
+    const int *outerKeys, *innerKeys;
+    size_t numOuterRows, numInnerRows;
+    if (std::ifstream(lineitemFile).good() && std::ifstream(ordersFile).good())
+    {
+        if (!lineitem.load(lineitemFile) || !orders.load(ordersFile))
+        {
+            context.destroy();
+            return -1;
+        }
+        outerKeys = lineitem.keys;
+        numOuterRows = lineitem.numRows;
+        innerKeys = orders.keys;
+        numInnerRows = orders.numRows;
+    }
+    else
+    {
+        std::cerr << "No " << lineitemFile << " and " << ordersFile << ", generating TPC-H shaped orderkeys" << std::endl;
+        generateTables(generatedLineitem, generatedOrders);
+        outerKeys = generatedLineitem.data();
+        numOuterRows = generatedLineitem.size();
+        innerKeys = generatedOrders.data();
+        numInnerRows = generatedOrders.size();
+    }
+
+    // The reference: a CPU hash join
+    std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+    HashJoinTable hashTable;
+    hashTable.build(innerKeys, numInnerRows);
+    double hashBuildTime = elapsedMs(startTime);
+    startTime = std::chrono::high_resolution_clock::now();
+    std::vector<JoinPair> expected = hashTable.probe(innerKeys, outerKeys, numOuterRows);
+    double hashJoinTime = elapsedMs(startTime);
+
+    KKIndex kkIndex;
+    kkIndex.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+    kkIndex.setuptFrameBuffersAndViewPort(viewportWidth, viewportHeight, true);
+    CpuIndex cpuIndex;
+
+    std::ostream out(csv);
+    out << "method,outer_rows,inner_rows,pairs,build_ms,join_ms,total_ms" << std::endl;
+    for (IndexBackend *index : std::vector<IndexBackend *>{&kkIndex, &cpuIndex})
+    {
+        double buildTime = 0;
+        if (!buildBackend(*index, innerKeys, numInnerRows, nullptr, buildTime))
+        {
+            context.destroy();
+            return -1;
+        }
+        startTime = std::chrono::high_resolution_clock::now();
+        std::vector<JoinPair> pairs = indexNestedLoopJoin(*index, outerKeys, numOuterRows, batchSize);
+        double joinTime = elapsedMs(startTime);
+        if (!samePairs(pairs, expected))
+        {
+            std::cerr << index->name() << " join returned " << pairs.size() << " pairs, the hash join " << expected.size() << std::endl;
+            context.destroy();
+            return -1;
+        }
+        out << index->name() << "_nested_loop," << numOuterRows << "," << numInnerRows << "," << pairs.size() << "," << buildTime << ","
+            << joinTime << "," << buildTime + joinTime << std::endl;
+    }
+    out << "cpu_hash," << numOuterRows << "," << numInnerRows << "," << expected.size() << "," << hashBuildTime << "," << hashJoinTime << ","
+        << hashBuildTime + hashJoinTime << std::endl;
+
+    context.destroy();
+    return 0;
+}
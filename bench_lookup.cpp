@@ -0,0 +1,95 @@
+// Measures batched point lookups (IN-lists) on KKIndex: lookupRows(), which
+// draws one point per probe, against the same probes asked as degenerate
+// [key, key + 1) ranges through queryRows(), and against CpuIndex. Keys are
+// generated in memory (uniform over [0, numRows * 2), so about half the
+// probes hit); probe batches grow by 8x up to numRows. Every batch is
+// checked against CpuIndex. Prints one CSV line per batch.
+//
+// Usage: bench_lookup [num_rows] [viewport_width viewport_height]
+// Run from the directory holding shader.vs and shader.fs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "cpu_index.h"
+#include "gl_context.h"
+#include "kk_index.h"
+
+bool sameResults(const QueryResults &a, const QueryResults &b)
+{
+    return a.offsets == b.offsets && a.rows == b.rows;
+}
+
+int main(int argc, char **argv)
+{
+    int numRows = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    int viewportWidth, viewportHeight;
+    if (!parseViewportArguments(argc, argv, 2, viewportWidth, viewportHeight))
+    {
+        return -1;
+    }
+
+    GLContext context;
+    if (!context.createHeadless())
+    {
+        return -1;
+    }
+
+    std::mt19937 random(42);
+    std::vector<int> keys = generateUniformKeys(numRows, random);
+
+    std::streambuf *csv = redirectLogToStderr();
+
+    KKIndex index;
+    index.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+    index.setuptFrameBuffersAndViewPort(viewportWidth, viewportHeight, true);
+    CpuIndex cpuIndex;
+    if (!index.build(keys.data(), keys.size()) || !cpuIndex.build(keys.data(), keys.size()))
+    {
+        context.destroy();
+        return -1;
+    }
+
+    std::ostream out(csv);
+    out << "probes,rows,lookup_ms,ranges_ms,cpu_ms,speedup_vs_ranges" << std::endl;
+    for (int batch = 1; batch <= numRows; batch *= 8)
+    {
+        std::vector<int> probes(batch);
+        std::vector<std::pair<int, int>> ranges(batch);
+        for (int p = 0; p < batch; ++p)
+        {
+            probes[p] = std::uniform_int_distribution<int>(0, 2 * numRows - 1)(random);
+            ranges[p] = {probes[p], probes[p] + 1};
+        }
+
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+        QueryResults lookupResults = index.lookupRows(probes);
+        double lookupTime = elapsedMs(startTime);
+
+        startTime = std::chrono::high_resolution_clock::now();
+        QueryResults rangeResults = index.queryRows(ranges, false);
+        double rangeTime = elapsedMs(startTime);
+
+        startTime = std::chrono::high_resolution_clock::now();
+        const QueryResults &cpuResults = cpuIndex.lookupRows(probes);
+        double cpuTime = elapsedMs(startTime);
+
+        if (!sameResults(lookupResults, cpuResults) || !sameResults(rangeResults, cpuResults))
+        {
+            std::cerr << "Batch of " << batch << " probes disagrees with CpuIndex" << std::endl;
+            context.destroy();
+            return -1;
+        }
+
+        out << batch << "," << lookupResults.totalRows() << "," << lookupTime << "," << rangeTime << "," << cpuTime << ","
+            << rangeTime / lookupTime << std::endl;
+    }
+
+    context.destroy();
+    return 0;
+}
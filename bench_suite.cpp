@@ -0,0 +1,420 @@
+// Sweeps the index backends over generated tables and query batches and
+// reports per-stage latency distributions.
+//
+// Tables are generated in memory (keys uniform over [0, rows * 2), like
+// tpch_1GB/create.py spreads its keys) and query batches like
+// tpch_1GB/queries.py: overlapping batches draw random starts, the
+// non-overlapping ones are evenly spaced. For every table size, viewport,
+// backend, range width, batch size and overlap mode the batch is answered
+// `warmup` times untimed and `repetitions` times timed. Every stage an index
+// logs ("query_time: 1.5 ms, gpu: 1.2 ms", ...) is collected per run, the
+// GPU time as a stage of its own ("query_time (gpu)"), along with the wall
+// time of the whole batch ("total"), and reported as
+// min/median/p90/p99/max. Build stages are reported once per table with
+// range_width and queries 0.
+//
+// The viewport only affects kk; cpu and btree run with the first one.
+//
+// Usage: bench_suite [--rows 1000000,4000000] [--viewports 256x256,1024x1024]
+//                    [--widths 16,256,4096,65536] [--queries 1,16,256]
+//                    [--backends kk,cpu,btree] [--engine raster|compute]
+//                    [--warmup 2] [--repetitions 10] [--seed 42]
+//                    [--csv file] [--json file]
+// The CSV goes to stdout unless --csv is given. Run from the directory
+// holding shader.vs, shader.fs and shader.comp.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "btree_index.h"
+#include "cpu_index.h"
+#include "gl_context.h"
+#include "index_backend.h"
+#include "kk_index.h"
+
+struct BenchConfig
+{
+    size_t rows;
+    int viewportWidth;
+    int viewportHeight;
+    std::string backend;
+    int rangeWidth;
+    int numQueries;
+    bool overlapping;
+};
+
+struct StageSummary
+{
+    BenchConfig config;
+    std::string stage;
+    std::vector<double> samples; // Sorted
+};
+
+std::vector<std::string> splitList(const char *list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<int> parseIntList(const char *list)
+{
+    std::vector<int> values;
+    for (const std::string &item : splitList(list))
+    {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+// Collects the "<stage>: <value> ms[, gpu: <value> ms]" lines of an index
+// log into stages; the GPU time goes to "<stage> (gpu)".
+void parseStageTimes(const std::string &log, std::map<std::string, std::vector<double>> &stages)
+{
+    std::istringstream lines(log);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t separator = line.find(": ");
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+        const char *value = line.c_str() + separator + 2;
+        char *end = nullptr;
+        double milliseconds = std::strtod(value, &end);
+        if (end == value || std::strncmp(end, " ms", 3) != 0)
+        {
+            continue;
+        }
+        std::string stage = line.substr(0, separator);
+        stages[stage].push_back(milliseconds);
+        if (std::strncmp(end + 3, ", gpu: ", 7) == 0)
+        {
+            stages[stage + " (gpu)"].push_back(std::strtod(end + 10, nullptr));
+        }
+    }
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+std::vector<std::pair<int, int>> generateQueries(int numQueries, int width, int domain, bool overlapping, std::mt19937 &random)
+{
+    std::vector<std::pair<int, int>> queries;
+    if (overlapping)
+    {
+        std::uniform_int_distribution<int> start(0, std::max(0, domain - width));
+        for (int q = 0; q < numQueries; ++q)
+        {
+            int first = start(random);
+            queries.push_back({first, first + width});
+        }
+    }
+    else
+    {
+        int stride = domain / numQueries;
+        for (int q = 0; q < numQueries; ++q)
+        {
+            queries.push_back({q * stride, q * stride + width});
+        }
+    }
+    return queries;
+}
+
+// Runs fn with std::cout captured and returns what it logged
+template <typename Fn>
+std::string captureLog(const Fn &fn)
+{
+    std::ostringstream log;
+    std::streambuf *previous = std::cout.rdbuf(log.rdbuf());
+    fn();
+    std::cout.rdbuf(previous);
+    return log.str();
+}
+
+void addSummaries(const BenchConfig &config, std::map<std::string, std::vector<double>> &stages, std::vector<StageSummary> &summaries)
+{
+    for (auto &stage : stages)
+    {
+        std::sort(stage.second.begin(), stage.second.end());
+        summaries.push_back({config, stage.first, stage.second});
+    }
+}
+
+void writeCsv(std::ostream &out, const std::vector<StageSummary> &summaries)
+{
+    out << "rows,viewport,backend,range_width,queries,overlapping,stage,samples,min_ms,median_ms,p90_ms,p99_ms,max_ms" << std::endl;
+    for (const StageSummary &summary : summaries)
+    {
+        const BenchConfig &config = summary.config;
+        out << config.rows << "," << config.viewportWidth << "x" << config.viewportHeight << "," << config.backend << ","
+            << config.rangeWidth << "," << config.numQueries << "," << (config.overlapping ? 1 : 0) << ",\"" << summary.stage
+            << "\"," << summary.samples.size() << "," << summary.samples.front() << "," << percentile(summary.samples, 50)
+            << "," << percentile(summary.samples, 90) << "," << percentile(summary.samples, 99) << ","
+            << summary.samples.back() << std::endl;
+    }
+}
+
+void writeJson(std::ostream &out, const std::vector<StageSummary> &summaries)
+{
+    out << "[" << std::endl;
+    for (size_t i = 0; i < summaries.size(); ++i)
+    {
+        const StageSummary &summary = summaries[i];
+        const BenchConfig &config = summary.config;
+        out << "  {\"rows\": " << config.rows << ", \"viewport\": [" << config.viewportWidth << ", " << config.viewportHeight
+            << "], \"backend\": \"" << config.backend << "\", \"range_width\": " << config.rangeWidth
+            << ", \"queries\": " << config.numQueries << ", \"overlapping\": " << (config.overlapping ? "true" : "false")
+            << ", \"stage\": \"" << summary.stage << "\", \"samples\": " << summary.samples.size()
+            << ", \"min_ms\": " << summary.samples.front() << ", \"median_ms\": " << percentile(summary.samples, 50)
+            << ", \"p90_ms\": " << percentile(summary.samples, 90) << ", \"p99_ms\": " << percentile(summary.samples, 99)
+            << ", \"max_ms\": " << summary.samples.back() << "}" << (i + 1 < summaries.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> rowCounts = {1000000, 4000000};
+    std::vector<std::string> viewports = {"256x256", "1024x1024"};
+    std::vector<int> widths = {16, 256, 4096, 65536};
+    std::vector<int> batchSizes = {1, 16, 256};
+    std::vector<std::string> backendNames = {"kk", "cpu", "btree"};
+    QueryEngine engine = QueryEngine::Raster;
+    int warmup = 2;
+    int repetitions = 10;
+    unsigned seed = 42;
+    const char *csvFile = nullptr;
+    const char *jsonFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return -1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--rows") {
+            rowCounts = parseIntList(value);
+        } else if (arg == "--viewports") {
+            viewports = splitList(value);
+        } else if (arg == "--widths") {
+            widths = parseIntList(value);
+        } else if (arg == "--queries") {
+            batchSizes = parseIntList(value);
+        } else if (arg == "--backends") {
+            backendNames = splitList(value);
+        } else if (arg == "--engine") {
+            engine = std::string(value) == "compute" ? QueryEngine::Compute : QueryEngine::Raster;
+        } else if (arg == "--warmup") {
+            warmup = std::atoi(value);
+        } else if (arg == "--repetitions") {
+            repetitions = std::max(1, std::atoi(value));
+        } else if (arg == "--seed") {
+            seed = std::atoi(value);
+        } else if (arg == "--csv") {
+            csvFile = value;
+        } else if (arg == "--json") {
+            jsonFile = value;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    std::vector<std::pair<int, int>> viewportSizes;
+    for (const std::string &viewport : viewports)
+    {
+        int width = 0, height = 0;
+        if (std::sscanf(viewport.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+        {
+            std::cerr << "Invalid viewport " << viewport << std::endl;
+            return -1;
+        }
+        viewportSizes.push_back({width, height});
+    }
+
+    GLContext context;
+    KKIndex kkIndex;
+    bool useGPU = std::find(backendNames.begin(), backendNames.end(), "kk") != backendNames.end();
+    if (useGPU)
+    {
+        useGPU = context.createHeadless();
+        if (useGPU)
+        {
+            captureLog([&]() {
+                kkIndex.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+                if (engine == QueryEngine::Compute && !kkIndex.compileComputeShader(loadShaderCode("shader.comp").c_str()))
+                {
+                    engine = QueryEngine::Raster;
+                }
+            });
+            kkIndex.engine = engine;
+        }
+        else
+        {
+            std::cerr << "No GL context, skipping the kk backend" << std::endl;
+        }
+    }
+    CpuIndex cpuIndex;
+    BTreeIndex btreeIndex;
+
+    std::mt19937 random(seed);
+    std::vector<StageSummary> summaries;
+    for (int numRows : rowCounts)
+    {
+        // The table: keys uniform over [0, numRows * 2)
+        const int domain = 2 * numRows;
+        std::vector<int> keys(numRows);
+        for (int &key : keys)
+        {
+            key = std::uniform_int_distribution<int>(0, domain - 1)(random);
+        }
+
+        for (size_t v = 0; v < viewportSizes.size(); ++v)
+        {
+            for (const std::string &backendName : backendNames)
+            {
+                IndexBackend *backend = nullptr;
+                if (backendName == "kk" && useGPU)
+                {
+                    backend = &kkIndex;
+                }
+                else if (backendName == "cpu" && v == 0)
+                {
+                    backend = &cpuIndex;
+                }
+                else if (backendName == "btree" && v == 0)
+                {
+                    backend = &btreeIndex;
+                }
+                if (!backend)
+                {
+                    continue;
+                }
+
+                BenchConfig config = {static_cast<size_t>(numRows), viewportSizes[v].first, viewportSizes[v].second,
+                                      backend->name(), 0, 0, false};
+                std::cerr << "rows " << numRows << ", viewport " << config.viewportWidth << "x" << config.viewportHeight
+                          << ", " << config.backend << std::endl;
+
+                double buildTime = 0;
+                bool built = false;
+                std::string buildLog = captureLog([&]() {
+                    if (backend == &kkIndex)
+                    {
+                        kkIndex.setuptFrameBuffersAndViewPort(config.viewportWidth, config.viewportHeight, true);
+                    }
+                    built = buildBackend(*backend, keys.data(), keys.size(), nullptr, buildTime);
+                });
+                if (!built)
+                {
+                    std::cerr << config.backend << " failed to build" << std::endl;
+                    continue;
+                }
+                std::map<std::string, std::vector<double>> buildStages;
+                parseStageTimes(buildLog, buildStages);
+                buildStages["total"].push_back(buildTime);
+                addSummaries(config, buildStages, summaries);
+
+                for (int width : widths)
+                {
+                    for (int numQueries : batchSizes)
+                    {
+                        for (bool overlapping : {false, true})
+                        {
+                            // Disjoint ranges of this width do not fit
+                            if (!overlapping && static_cast<long long>(numQueries) * width > domain)
+                            {
+                                continue;
+                            }
+                            config.rangeWidth = width;
+                            config.numQueries = numQueries;
+                            config.overlapping = overlapping;
+                            std::vector<std::pair<int, int>> queries = generateQueries(numQueries, width, domain, overlapping, random);
+
+                            captureLog([&]() {
+                                for (int r = 0; r < warmup; ++r)
+                                {
+                                    backend->queryRows(queries, !overlapping);
+                                }
+                            });
+                            std::map<std::string, std::vector<double>> stages;
+                            for (int r = 0; r < repetitions; ++r)
+                            {
+                                double total = 0;
+                                std::string log = captureLog([&]() {
+                                    std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+                                    backend->queryRows(queries, !overlapping);
+                                    std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+                                    std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+                                    total = elapsed.count();
+                                });
+                                parseStageTimes(log, stages);
+                                stages["total"].push_back(total);
+                            }
+                            addSummaries(config, stages, summaries);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (useGPU)
+    {
+        context.destroy();
+    }
+
+    if (csvFile)
+    {
+        std::ofstream csv(csvFile);
+        if (!csv)
+        {
+            std::cerr << "Failed to open " << csvFile << std::endl;
+            return -1;
+        }
+        writeCsv(csv, summaries);
+    }
+    else
+    {
+        writeCsv(std::cout, summaries);
+    }
+    if (jsonFile)
+    {
+        std::ofstream json(jsonFile);
+        if (!json)
+        {
+            std::cerr << "Failed to open " << jsonFile << std::endl;
+            return -1;
+        }
+        writeJson(json, summaries);
+    }
+    return 0;
+}
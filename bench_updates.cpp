@@ -0,0 +1,170 @@
+// Measures incremental updates of KKIndex against rebuilding it. Keys are
+// generated in memory (uniform over [0, numRows * 2)); then batches of
+// growing size are applied, half inserts and half deletes of random rows.
+// One insert in twenty gets a key outside the current range, on either
+// side, so the domain grows. After every batch a few ranges are queried and
+// checked against a scan of the live rows. Finally the index is rebuilt
+// from the whole key column, which every batch is compared with. Prints one
+// CSV line per batch.
+//
+// Usage: bench_updates [num_rows] [viewport_width viewport_height]
+// Run from the directory holding shader.vs and shader.fs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bench_common.h"
+#include "gl_context.h"
+#include "kk_index.h"
+
+// Rows of the live table whose key is in [start, end), ascending
+std::vector<int> scanRows(const std::vector<int> &keys, const std::vector<char> &live, int start, int end)
+{
+    std::vector<int> rows;
+    for (size_t row = 0; row < keys.size(); ++row)
+    {
+        if (live[row] && keys[row] >= start && keys[row] < end)
+        {
+            rows.push_back(static_cast<int>(row));
+        }
+    }
+    return rows;
+}
+
+int main(int argc, char **argv)
+{
+    int numRows = argc > 1 ? std::atoi(argv[1]) : 4000000;
+    int viewportWidth, viewportHeight;
+    if (!parseViewportArguments(argc, argv, 2, viewportWidth, viewportHeight))
+    {
+        return -1;
+    }
+
+    GLContext context;
+    if (!context.createHeadless())
+    {
+        return -1;
+    }
+
+    std::mt19937 random(42);
+    std::vector<int> keys = generateUniformKeys(numRows, random);
+    std::vector<char> live(numRows, 1);
+    std::vector<int> liveRows(numRows);
+    for (int row = 0; row < numRows; ++row)
+    {
+        liveRows[row] = row;
+    }
+    int low = 0, high = 2 * numRows; // Key range so far
+
+    std::streambuf *csv = redirectLogToStderr();
+
+    KKIndex index;
+    index.updatable = true;
+    index.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+    index.setuptFrameBuffersAndViewPort(viewportWidth, viewportHeight, true);
+    if (!index.build(keys.data(), keys.size()))
+    {
+        context.destroy();
+        return -1;
+    }
+
+    struct BatchTiming
+    {
+        int batch, inserts, deletes;
+        size_t liveRows;
+        int domain;
+        double updateTime;
+    };
+    std::vector<BatchTiming> timings;
+    for (int batch = 1; batch <= std::max(1, numRows / 4); batch *= 8)
+    {
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+        int inserts = 0, deletes = 0;
+        for (int i = 0; i < batch; ++i)
+        {
+            if (i % 2 == 0)
+            {
+                int key;
+                if (i % 40 == 0)
+                {
+                    // Outside the range, alternately below and above it
+                    key = (i / 40) % 2 ? --low : high++;
+                }
+                else
+                {
+                    key = std::uniform_int_distribution<int>(0, 2 * numRows - 1)(random);
+                }
+                int row = static_cast<int>(keys.size());
+                if (!index.insertRow(key, row))
+                {
+                    context.destroy();
+                    return -1;
+                }
+                keys.push_back(key);
+                live.push_back(1);
+                liveRows.push_back(row);
+                ++inserts;
+            }
+            else
+            {
+                size_t victim = std::uniform_int_distribution<size_t>(0, liveRows.size() - 1)(random);
+                int row = liveRows[victim];
+                if (!index.deleteRow(keys[row], row))
+                {
+                    std::cerr << "Row " << row << " was not indexed" << std::endl;
+                    context.destroy();
+                    return -1;
+                }
+                live[row] = 0;
+                liveRows[victim] = liveRows.back();
+                liveRows.pop_back();
+                ++deletes;
+            }
+        }
+        index.flushUpdates();
+        glFinish();
+        double updateTime = elapsedMs(startTime);
+
+        // Ranges across the grown edges and the middle of the domain
+        std::vector<std::pair<int, int>> queries = {
+            {low, low + 64}, {high - 64, high}, {numRows, numRows + 4096}, {low, high}};
+        const QueryResults &results = index.queryRows(queries, false);
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            std::vector<int> expected = scanRows(keys, live, queries[q].first, queries[q].second);
+            std::vector<int> actual(results[q].begin(), results[q].end());
+            if (actual != expected)
+            {
+                std::cerr << "Batch " << batch << ", query [" << queries[q].first << ", " << queries[q].second << "): " << actual.size()
+                          << " rows, expected " << expected.size() << std::endl;
+                context.destroy();
+                return -1;
+            }
+        }
+
+        timings.push_back({batch, inserts, deletes, liveRows.size(), index.domainSize, updateTime});
+    }
+
+    // The alternative to every batch: build again from the key column
+    // (deleted rows included, as they keep their row identifiers)
+    std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+    index.updatable = false;
+    index.build(keys.data(), keys.size());
+    glFinish();
+    double rebuildTime = elapsedMs(startTime);
+
+    std::ostream out(csv);
+    out << "batch,inserts,deletes,live_rows,domain,update_ms,rebuild_ms,speedup" << std::endl;
+    for (const BatchTiming &timing : timings)
+    {
+        out << timing.batch << "," << timing.inserts << "," << timing.deletes << "," << timing.liveRows << "," << timing.domain << ","
+            << timing.updateTime << "," << rebuildTime << "," << rebuildTime / timing.updateTime << std::endl;
+    }
+
+    context.destroy();
+    return 0;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+// BTreeIndex: a static, read-optimized B+tree over the sorted keys, as the
+// classic ordered-index baseline for KKIndex.
+//
+// Every node is one 64-byte cache line of 16 int32 keys. The leaves are the
+// sorted keys themselves (padded with INT_MAX to whole nodes), with the row
+// identifier of each key at the same position of a parallel array. An inner
+// level stores, for each node of the level below, that node's largest key;
+// its nodes group 16 children each. lower_bound descends from the root
+// counting, in each node, the children whose largest key is below the
+// search key, so every level costs one cache line and one 16-wide compare.
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "index_backend.h"
+#include "metrics.h"
+
+// Allocates on 64-byte boundaries, so that with levels padded to whole
+// nodes every node is exactly one cache line
+template <typename T>
+struct CacheLineAllocator
+{
+    using value_type = T;
+    static constexpr size_t kAlignment = 64;
+
+    CacheLineAllocator() = default;
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(kAlignment))); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(kAlignment)); }
+
+    template <typename U>
+    bool operator==(const CacheLineAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheLineAllocator<U> &) const { return false; }
+};
+
+// One level of the tree: nodes of kNodeKeys keys, cache line aligned
+using BTreeLevel = std::vector<int, CacheLineAllocator<int>>;
+
+class BTreeIndex : public IndexBackend
+{
+public:
+    static const int kNodeKeys = 16; // 64-byte nodes
+    static_assert(kNodeKeys * sizeof(int) == CacheLineAllocator<int>::kAlignment, "A node must fill one cache line");
+
+    std::vector<BTreeLevel> levels;       // levels[0] is the leaf level, levels.back() the root
+    std::vector<int> sortedRows;          // Row identifier of each leaf key
+    int numThreads = 0;                   // Workers; 0 means one per hardware thread
+    QueryResults results;                 // Row identifiers of the last batch
+
+    const char *name() const override { return "btree"; }
+
+    bool build(const int *keys, size_t numRows, const int *payload = nullptr) override
+    {
+        StageTimer timer("btree_build_time");
+        this->keys = keys;
+        this->payload = payload;
+        this->numRows = numRows;
+        if (this->numThreads <= 0)
+        {
+            this->numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        std::vector<std::pair<int, int>> pairs(numRows);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            pairs[row] = {keys[row], static_cast<int>(row)};
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        this->levels.clear();
+        BTreeLevel leaves(roundUpToNode(std::max<size_t>(numRows, 1)), INT_MAX);
+        this->sortedRows.resize(numRows);
+        for (size_t i = 0; i < numRows; ++i)
+        {
+            leaves[i] = pairs[i].first;
+            this->sortedRows[i] = pairs[i].second;
+        }
+        this->levels.push_back(std::move(leaves));
+
+        // Add inner levels until one node holds all children
+        while (this->levels.back().size() > kNodeKeys)
+        {
+            const BTreeLevel &below = this->levels.back();
+            size_t children = below.size() / kNodeKeys;
+            BTreeLevel level(roundUpToNode(children), INT_MAX);
+            for (size_t child = 0; child < children; ++child)
+            {
+                level[child] = below[child * kNodeKeys + kNodeKeys - 1];
+            }
+            this->levels.push_back(std::move(level));
+        }
+
+        timer.stop("(" + std::to_string(this->levels.size()) + " levels)");
+        return true;
+    }
+
+    size_t memoryFootprint() const override
+    {
+        size_t bytes = this->sortedRows.capacity() * sizeof(int);
+        for (const auto &level : this->levels)
+        {
+            bytes += level.capacity() * sizeof(int);
+        }
+        return bytes + this->results.offsets.capacity() * sizeof(size_t) + this->results.rows.capacity() * sizeof(int);
+    }
+
+    // Position of the first leaf key >= key, numRows if there is none
+    size_t lowerBound(int key) const
+    {
+        size_t node = 0;
+        for (size_t l = this->levels.size(); l-- > 0;)
+        {
+            node = node * kNodeKeys + countBelow(this->levels[l].data() + node * kNodeKeys, key);
+            // Past the last child: key is above every key
+            if (l > 0 && node * kNodeKeys >= this->levels[l - 1].size())
+            {
+                return this->numRows;
+            }
+        }
+        return std::min(node, this->numRows);
+    }
+
+    const QueryResults &queryRows(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping) override
+    {
+        StageTimer timer("btree_query_time");
+        (void)queriesAreNonOverlapping;
+        const size_t numQueries = queries.size();
+        std::vector<std::pair<size_t, size_t>> ranges(numQueries);
+        this->results.offsets.resize(numQueries + 1);
+        size_t total = 0;
+        for (size_t q = 0; q < numQueries; ++q)
+        {
+            size_t first = lowerBound(queries[q].first);
+            size_t last = queries[q].second > queries[q].first ? lowerBound(queries[q].second) : first;
+            ranges[q] = {first, last};
+            this->results.offsets[q] = total;
+            total += last - first;
+        }
+        this->results.offsets[numQueries] = total;
+        this->results.rows.resize(total);
+
+        // Leaves hold the rows in key order; sort each query's slice by row
+        parallelFor(numQueries, this->numThreads, [&](size_t q) {
+            int *out = this->results.rows.data() + this->results.offsets[q];
+            std::copy(this->sortedRows.begin() + ranges[q].first, this->sortedRows.begin() + ranges[q].second, out);
+            std::sort(out, out + (ranges[q].second - ranges[q].first));
+        });
+
+        timer.stop();
+        return this->results;
+    }
+
+private:
+    static size_t roundUpToNode(size_t count)
+    {
+        return (count + kNodeKeys - 1) / kNodeKeys * kNodeKeys;
+    }
+
+    // Number of the node's 16 keys that are < key
+    static int countBelow(const int *node, int key)
+    {
+#if defined(__AVX512F__)
+        __m512i keys = _mm512_loadu_si512(node);
+        return __builtin_popcount(_mm512_cmplt_epi32_mask(keys, _mm512_set1_epi32(key)));
+#elif defined(__AVX2__)
+        __m256i search = _mm256_set1_epi32(key);
+        __m256i low = _mm256_cmpgt_epi32(search, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node)));
+        __m256i high = _mm256_cmpgt_epi32(search, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node + 8)));
+        return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(low))) +
+               __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(high)));
+#else
+        int count = 0;
+        for (int i = 0; i < kNodeKeys; ++i)
+        {
+            count += node[i] < key;
+        }
+        return count;
+#endif
+    }
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+// Fixed-width binary columnar table files (.kkcol).
+//
+// A .kkcol file holds a subset of the columns of a '|'-delimited .tbl file as
+// raw int32 arrays so that they can be mmap'ed and used in place:
+//
+//   ColumnTableHeader                     (64 bytes)
+//   int32 sourceColumns[numColumns]       (column index in the .tbl file)
+//   padding up to dataOffset
+//   column 0: int32[numRows], padded to columnStride bytes
+//   column 1: ...
+//
+// dataOffset and columnStride are multiples of 64 so every column starts on a
+// cache line. The first stored column is the key column used by KKIndex.
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kColumnTableMagic[8] = {'K', 'K', 'C', 'O', 'L', '\0', '\0', '\0'};
+static const uint32_t kColumnTableVersion = 1;
+static const uint64_t kColumnTableAlignment = 64;
+
+struct ColumnTableHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numColumns;
+    uint64_t numRows;
+    uint64_t dataOffset;   // Byte offset of the first column
+    uint64_t columnStride; // Bytes between the starts of consecutive columns
+    uint8_t reserved[24];
+};
+static_assert(sizeof(ColumnTableHeader) == 64, "ColumnTableHeader must stay 64 bytes");
+
+inline uint64_t alignColumnTableOffset(uint64_t offset)
+{
+    return (offset + kColumnTableAlignment - 1) & ~(kColumnTableAlignment - 1);
+}
+
+// Offsets derived from the column and row counts; a valid file has exactly
+// this dataOffset and columnStride
+struct ColumnTableLayout
+{
+    uint64_t dataOffset;
+    uint64_t columnStride;
+    uint64_t fileSize;
+
+    ColumnTableLayout(uint64_t numColumns, uint64_t numRows)
+    {
+        dataOffset = alignColumnTableOffset(sizeof(ColumnTableHeader) + numColumns * sizeof(int32_t));
+        columnStride = alignColumnTableOffset(numRows * sizeof(int32_t));
+        fileSize = dataOffset + numColumns * columnStride;
+    }
+};
+
+// Returns true if the file starts with the .kkcol magic.
+inline bool isColumnTableFile(const char *filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(kColumnTableMagic)];
+    if (!file.read(magic, sizeof(magic)))
+    {
+        return false;
+    }
+    return std::memcmp(magic, kColumnTableMagic, sizeof(magic)) == 0;
+}
+
+// Writes the given int32 columns into a .kkcol file. All columns must have the
+// same number of rows. sourceColumns[i] records which .tbl column columns[i]
+// came from.
+inline bool writeColumnTable(const char *filename, const std::vector<int> &sourceColumns,
+                             const std::vector<const int *> &columns, uint64_t numRows)
+{
+    if (sourceColumns.size() != columns.size() || columns.empty())
+    {
+        std::cerr << "writeColumnTable: need one source index per column" << std::endl;
+        return false;
+    }
+
+    ColumnTableHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kColumnTableMagic, sizeof(header.magic));
+    header.version = kColumnTableVersion;
+    header.numColumns = static_cast<uint32_t>(columns.size());
+    header.numRows = numRows;
+    ColumnTableLayout layout(columns.size(), numRows);
+    header.dataOffset = layout.dataOffset;
+    header.columnStride = layout.columnStride;
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    static const char padding[kColumnTableAlignment] = {0};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (int sourceColumn : sourceColumns)
+    {
+        int32_t value = sourceColumn;
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+    uint64_t written = sizeof(header) + sourceColumns.size() * sizeof(int32_t);
+    file.write(padding, header.dataOffset - written);
+
+    uint64_t columnBytes = numRows * sizeof(int32_t);
+    for (const int *column : columns)
+    {
+        file.write(reinterpret_cast<const char *>(column), columnBytes);
+        file.write(padding, header.columnStride - columnBytes);
+    }
+
+    if (!file.good())
+    {
+        std::cerr << "Failed to write column table: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Read-only mmap view of a .kkcol file. Columns are used in place; nothing is
+// copied or parsed.
+struct MappedColumnTable
+{
+    void *base = nullptr;
+    size_t mappedSize = 0;
+    const ColumnTableHeader *header = nullptr;
+    const int32_t *sourceColumns = nullptr;
+
+    MappedColumnTable() = default;
+    MappedColumnTable(const MappedColumnTable &) = delete;
+    MappedColumnTable &operator=(const MappedColumnTable &) = delete;
+
+    bool open(const char *filename)
+    {
+        close();
+
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Failed to open file: " << filename << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ColumnTableHeader))
+        {
+            std::cerr << "Column table is too small: " << filename << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            std::cerr << "Failed to mmap column table: " << filename << std::endl;
+            return false;
+        }
+
+        base = mapped;
+        mappedSize = st.st_size;
+        header = static_cast<const ColumnTableHeader *>(base);
+
+        if (std::memcmp(header->magic, kColumnTableMagic, sizeof(header->magic)) != 0 ||
+            header->version != kColumnTableVersion)
+        {
+            std::cerr << "Not a version " << kColumnTableVersion << " column table: " << filename << std::endl;
+            close();
+            return false;
+        }
+
+        // Check the counts against the file size first, so the layout
+        // derived from them cannot overflow
+        if (header->numColumns == 0 || header->numRows > mappedSize / sizeof(int32_t) ||
+            header->numColumns > mappedSize / sizeof(int32_t))
+        {
+            std::cerr << "Column table is truncated: " << filename << std::endl;
+            close();
+            return false;
+        }
+        ColumnTableLayout layout(header->numColumns, header->numRows);
+        if (header->dataOffset != layout.dataOffset || header->columnStride != layout.columnStride)
+        {
+            std::cerr << "Column table header is corrupt: " << filename << std::endl;
+            close();
+            return false;
+        }
+        if (layout.fileSize > mappedSize)
+        {
+            std::cerr << "Column table is truncated: " << filename << std::endl;
+            close();
+            return false;
+        }
+        sourceColumns = reinterpret_cast<const int32_t *>(static_cast<const char *>(base) + sizeof(ColumnTableHeader));
+
+        // Columns are scanned front to back while building the index.
+        madvise(base, mappedSize, MADV_SEQUENTIAL);
+        madvise(base, mappedSize, MADV_WILLNEED);
+        return true;
+    }
+
+    void close()
+    {
+        if (base)
+        {
+            munmap(base, mappedSize);
+        }
+        base = nullptr;
+        mappedSize = 0;
+        header = nullptr;
+        sourceColumns = nullptr;
+    }
+
+    size_t numRows() const { return header ? header->numRows : 0; }
+    size_t numColumns() const { return header ? header->numColumns : 0; }
+
+    // i-th stored column (0 is the key column).
+    const int *column(size_t i) const
+    {
+        return reinterpret_cast<const int *>(static_cast<const char *>(base) + header->dataOffset + i * header->columnStride);
+    }
+
+    // Stored column that came from .tbl column sourceColumn, or nullptr.
+    const int *findSourceColumn(int sourceColumn) const
+    {
+        for (size_t i = 0; i < numColumns(); ++i)
+        {
+            if (sourceColumns[i] == sourceColumn)
+            {
+                return column(i);
+            }
+        }
+        return nullptr;
+    }
+
+    ~MappedColumnTable() { close(); }
+};
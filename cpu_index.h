@@ -0,0 +1,336 @@
+#pragma once
+
+// CpuIndex: the CPU range index, used on hosts without a usable GPU context
+// and as the baseline for the GPU engines. It answers the same batches as
+// KKIndex::queryRows() into the same QueryResults.
+//
+// Two access paths, picked per query:
+//   sorted  A (key, rowId) permutation sorted by key. Binary search gives the
+//           exact row count of every query up front; narrow ranges copy
+//           their slice of row ids and sort it.
+//   scan    A filter over the contiguous key column that emits matching row
+//           ids in ascending order with compress-stores (AVX-512
+//           vpcompressd, AVX2 permute via a lookup table, or scalar). The
+//           column is split into partitions scanned by worker threads; a
+//           counting pass gives each partition its output offset, so the
+//           scan writes straight into the results.
+// A query scans when its rows are more than 1 / kScanSelectivity of the
+// table, where sorting the slice would cost more than reading the column.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "index_backend.h"
+#include "metrics.h"
+
+#if defined(__AVX2__) && !defined(__AVX512F__)
+// Lane permutation that packs the lanes set in an 8-bit mask to the front
+struct CompressTable
+{
+    alignas(32) int32_t permutations[256][8];
+
+    CompressTable()
+    {
+        for (int mask = 0; mask < 256; ++mask)
+        {
+            int lane = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                if (mask & (1 << i))
+                {
+                    permutations[mask][lane++] = i;
+                }
+            }
+            for (; lane < 8; ++lane)
+            {
+                permutations[mask][lane] = 0;
+            }
+        }
+    }
+};
+
+inline const CompressTable &compressTable()
+{
+    static const CompressTable table;
+    return table;
+}
+#endif
+
+// Counts the rows in [begin, end) with lo <= key < hi.
+inline size_t countRange(const int *keys, size_t begin, size_t end, int lo, int hi)
+{
+    if (hi <= lo)
+    {
+        return 0;
+    }
+    // lo <= key < hi  <=>  unsigned(key - lo) < unsigned(hi - lo)
+    const uint32_t width = static_cast<uint32_t>(hi) - static_cast<uint32_t>(lo);
+    size_t count = 0;
+    size_t i = begin;
+#if defined(__AVX512F__)
+    const __m512i low = _mm512_set1_epi32(lo);
+    const __m512i span = _mm512_set1_epi32(static_cast<int>(width));
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512i key = _mm512_loadu_si512(keys + i);
+        count += __builtin_popcount(_mm512_cmplt_epu32_mask(_mm512_sub_epi32(key, low), span));
+    }
+#elif defined(__AVX2__)
+    // AVX2 has no unsigned compare: flip the sign bits and compare signed
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i signBit = _mm256_set1_epi32(INT32_MIN);
+    const __m256i span = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(width)), signBit);
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        __m256i offset = _mm256_xor_si256(_mm256_sub_epi32(key, low), signBit);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(span, offset))));
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        count += static_cast<uint32_t>(keys[i]) - static_cast<uint32_t>(lo) < width;
+    }
+    return count;
+}
+
+// Writes the row ids in [begin, end) with lo <= key < hi to out, in
+// ascending order. out must hold exactly the countRange() rows; nothing is
+// written past them.
+inline size_t scanRange(const int *keys, size_t begin, size_t end, int lo, int hi, int *out, size_t capacity)
+{
+    if (hi <= lo)
+    {
+        return 0;
+    }
+    const uint32_t width = static_cast<uint32_t>(hi) - static_cast<uint32_t>(lo);
+    size_t n = 0;
+    size_t i = begin;
+#if defined(__AVX512F__)
+    const __m512i low = _mm512_set1_epi32(lo);
+    const __m512i span = _mm512_set1_epi32(static_cast<int>(width));
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512i rows = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(begin)),
+                                    _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512i key = _mm512_loadu_si512(keys + i);
+        __mmask16 match = _mm512_cmplt_epu32_mask(_mm512_sub_epi32(key, low), span);
+        // vpcompressd stores only the selected lanes, so it never overruns
+        _mm512_mask_compressstoreu_epi32(out + n, match, rows);
+        n += __builtin_popcount(match);
+        rows = _mm512_add_epi32(rows, step);
+    }
+#elif defined(__AVX2__)
+    const CompressTable &table = compressTable();
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i signBit = _mm256_set1_epi32(INT32_MIN);
+    const __m256i span = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(width)), signBit);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i rows = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(begin)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        __m256i offset = _mm256_xor_si256(_mm256_sub_epi32(key, low), signBit);
+        int match = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(span, offset)));
+        __m256i packed = _mm256_permutevar8x32_epi32(rows, _mm256_load_si256(reinterpret_cast<const __m256i *>(table.permutations[match])));
+        int matches = __builtin_popcount(match);
+        if (n + 8 <= capacity)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + n), packed);
+        }
+        else
+        {
+            // Near the end of out a full store would overwrite the next
+            // partition's rows
+            alignas(32) int lanes[8];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), packed);
+            std::memcpy(out + n, lanes, matches * sizeof(int));
+        }
+        n += matches;
+        rows = _mm256_add_epi32(rows, step);
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        if (static_cast<uint32_t>(keys[i]) - static_cast<uint32_t>(lo) < width)
+        {
+            out[n++] = static_cast<int>(i);
+        }
+    }
+    return n;
+}
+
+class CpuIndex : public IndexBackend
+{
+public:
+    // A query scans the column when it selects more than this fraction of
+    // the rows
+    static const int kScanSelectivity = 64;
+    // Rows per scan partition
+    static const size_t kPartitionRows = 1 << 20;
+
+    std::vector<int> sortedKeys; // Keys in ascending order
+    std::vector<int> sortedRows; // Row identifier of each sortedKeys entry
+    int numThreads = 0;          // Workers; 0 means one per hardware thread
+    QueryResults results;        // Row identifiers of the last batch
+
+    const char *name() const override { return "cpu"; }
+
+    bool build(const int *keys, size_t numRows, const int *payload = nullptr) override
+    {
+        StageTimer timer("cpu_index_build_time");
+        this->keys = keys;
+        this->payload = payload;
+        this->numRows = numRows;
+        if (this->numThreads <= 0)
+        {
+            this->numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        std::vector<std::pair<int, int>> pairs(numRows);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            pairs[row] = {keys[row], static_cast<int>(row)};
+        }
+        std::sort(pairs.begin(), pairs.end());
+        this->sortedKeys.resize(numRows);
+        this->sortedRows.resize(numRows);
+        for (size_t i = 0; i < numRows; ++i)
+        {
+            this->sortedKeys[i] = pairs[i].first;
+            this->sortedRows[i] = pairs[i].second;
+        }
+
+        timer.stop();
+        return true;
+    }
+
+    size_t memoryFootprint() const override
+    {
+        return (this->sortedKeys.capacity() + this->sortedRows.capacity()) * sizeof(int) +
+               this->results.offsets.capacity() * sizeof(size_t) + this->results.rows.capacity() * sizeof(int);
+    }
+
+    // Position range of [lo, hi) in sortedKeys
+    std::pair<size_t, size_t> sortedRange(int lo, int hi) const
+    {
+        if (hi <= lo)
+        {
+            return {0, 0};
+        }
+        size_t first = std::lower_bound(this->sortedKeys.begin(), this->sortedKeys.end(), lo) - this->sortedKeys.begin();
+        size_t last = std::lower_bound(this->sortedKeys.begin() + first, this->sortedKeys.end(), hi) - this->sortedKeys.begin();
+        return {first, last};
+    }
+
+    // Overlapping queries need no decomposition here, so
+    // queriesAreNonOverlapping is ignored.
+    const QueryResults &queryRows(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping) override
+    {
+        StageTimer timer("cpu_query_time");
+        (void)queriesAreNonOverlapping;
+        const size_t numQueries = queries.size();
+        const size_t numPartitions = std::max<size_t>(1, (this->numRows + kPartitionRows - 1) / kPartitionRows);
+
+        // Exact sizes from the sorted permutation
+        std::vector<std::pair<size_t, size_t>> ranges(numQueries);
+        this->results.offsets.resize(numQueries + 1);
+        size_t total = 0;
+        for (size_t q = 0; q < numQueries; ++q)
+        {
+            ranges[q] = sortedRange(queries[q].first, queries[q].second);
+            this->results.offsets[q] = total;
+            total += ranges[q].second - ranges[q].first;
+        }
+        this->results.offsets[numQueries] = total;
+        this->results.rows.resize(total);
+
+        // One task per narrow query, one per (wide query, partition)
+        struct Task
+        {
+            size_t query;
+            size_t partition; // SIZE_MAX for the sorted path
+        };
+        std::vector<Task> tasks;
+        std::vector<size_t> scanQueries;
+        for (size_t q = 0; q < numQueries; ++q)
+        {
+            size_t count = ranges[q].second - ranges[q].first;
+            if (count * kScanSelectivity > this->numRows)
+            {
+                scanQueries.push_back(q);
+                for (size_t p = 0; p < numPartitions; ++p)
+                {
+                    tasks.push_back(Task{q, p});
+                }
+            }
+            else if (count > 0)
+            {
+                tasks.push_back(Task{q, SIZE_MAX});
+            }
+        }
+
+        // Output offset of every (wide query, partition) from a counting pass
+        std::vector<size_t> partitionOffsets(scanQueries.size() * numPartitions);
+        parallelFor(scanQueries.size() * numPartitions, this->numThreads, [&](size_t i) {
+            size_t q = scanQueries[i / numPartitions];
+            size_t p = i % numPartitions;
+            partitionOffsets[i] = countRange(this->keys, partitionBegin(p), partitionBegin(p + 1), queries[q].first, queries[q].second);
+        });
+        for (size_t s = 0; s < scanQueries.size(); ++s)
+        {
+            size_t offset = this->results.offsets[scanQueries[s]];
+            for (size_t p = 0; p < numPartitions; ++p)
+            {
+                size_t count = partitionOffsets[s * numPartitions + p];
+                partitionOffsets[s * numPartitions + p] = offset;
+                offset += count;
+            }
+        }
+
+        size_t scanTask = 0;
+        std::vector<size_t> scanTaskIndex(tasks.size());
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            scanTaskIndex[t] = tasks[t].partition == SIZE_MAX ? SIZE_MAX : scanTask++;
+        }
+        parallelFor(tasks.size(), this->numThreads, [&](size_t t) {
+            const Task &task = tasks[t];
+            int *rows = this->results.rows.data();
+            if (task.partition == SIZE_MAX)
+            {
+                int *out = rows + this->results.offsets[task.query];
+                std::copy(this->sortedRows.begin() + ranges[task.query].first, this->sortedRows.begin() + ranges[task.query].second, out);
+                std::sort(out, out + (ranges[task.query].second - ranges[task.query].first));
+                return;
+            }
+            size_t i = scanTaskIndex[t];
+            size_t begin = partitionOffsets[i];
+            size_t end = (i + 1) % numPartitions == 0 ? this->results.offsets[task.query + 1] : partitionOffsets[i + 1];
+            scanRange(this->keys, partitionBegin(task.partition), partitionBegin(task.partition + 1),
+                      queries[task.query].first, queries[task.query].second, rows + begin, end - begin);
+        });
+
+        timer.stop("(" + std::to_string(scanQueries.size()) + " scans, " + std::to_string(numQueries - scanQueries.size()) +
+                   " sorted lookups)");
+        return this->results;
+    }
+
+private:
+    size_t partitionBegin(size_t partition) const
+    {
+        return std::min(this->numRows, partition * kPartitionRows);
+    }
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+// OpenGL context creation.
+//
+// KKIndex renders into an FBO, so it does not need a window. The default path
+// creates a headless EGL context: a surfaceless display (EGL_MESA_platform_
+// surfaceless), otherwise the first EGL device (EGL_EXT_platform_device),
+// otherwise the default display. The context is made current without a
+// surface when EGL_KHR_surfaceless_context is available and on a 1x1 pbuffer
+// otherwise. This works on Mesa llvmpipe as well as on vendor drivers and
+// needs no X11/Wayland server.
+//
+// The GLFW window path is kept for on-screen debugging.
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <iostream>
+
+inline bool hasEGLExtension(const char *extensions, const char *name)
+{
+    if (!extensions)
+    {
+        return false;
+    }
+    size_t length = std::strlen(name);
+    for (const char *p = extensions; (p = std::strstr(p, name)) != nullptr; p += length)
+    {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct GLContext
+{
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    EGLContext eglContext = EGL_NO_CONTEXT;
+    EGLSurface eglSurface = EGL_NO_SURFACE;
+    GLFWwindow *window = nullptr;
+
+    // Creates a headless EGL context with OpenGL 4.3+ core profile.
+    bool createHeadless()
+    {
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+        if (getPlatformDisplay && hasEGLExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+        {
+            eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (!initializeDisplay())
+            {
+                eglDisplay = EGL_NO_DISPLAY;
+            }
+        }
+        if (eglDisplay == EGL_NO_DISPLAY && getPlatformDisplay && hasEGLExtension(clientExtensions, "EGL_EXT_platform_device"))
+        {
+            PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+            EGLDeviceEXT device;
+            EGLint numDevices = 0;
+            if (queryDevices && queryDevices(1, &device, &numDevices) && numDevices > 0)
+            {
+                eglDisplay = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+                if (!initializeDisplay())
+                {
+                    eglDisplay = EGL_NO_DISPLAY;
+                }
+            }
+        }
+        if (eglDisplay == EGL_NO_DISPLAY)
+        {
+            eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if (!initializeDisplay())
+            {
+                std::cerr << "EGL initialization failed" << std::endl;
+                eglDisplay = EGL_NO_DISPLAY;
+                return false;
+            }
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cerr << "EGL does not support desktop OpenGL" << std::endl;
+            destroy();
+            return false;
+        }
+
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_NONE};
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+        {
+            std::cerr << "No suitable EGL config" << std::endl;
+            destroy();
+            return false;
+        }
+
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE};
+        eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+        if (eglContext == EGL_NO_CONTEXT)
+        {
+            std::cerr << "Failed to create an OpenGL 4.3 core EGL context" << std::endl;
+            destroy();
+            return false;
+        }
+
+        const char *displayExtensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+        if (!hasEGLExtension(displayExtensions, "EGL_KHR_surfaceless_context"))
+        {
+            const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+            eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+            if (eglSurface == EGL_NO_SURFACE)
+            {
+                std::cerr << "Failed to create EGL pbuffer" << std::endl;
+                destroy();
+                return false;
+            }
+        }
+        if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+        {
+            std::cerr << "Failed to make the EGL context current" << std::endl;
+            destroy();
+            return false;
+        }
+
+        // glewInit() also loads GLX entry points and fails without an X
+        // display, so only initialize the GL part.
+        glewExperimental = GL_TRUE;
+        GLenum err = glewContextInit();
+        if (GLEW_OK != err)
+        {
+            std::cerr << "GLEW initialization failed: " << glewGetErrorString(err) << std::endl;
+            destroy();
+            return false;
+        }
+        return true;
+    }
+
+    // Creates a (visible) GLFW window with an OpenGL 4.3 core context.
+    bool createWindow(int width, int height, const char *title)
+    {
+        if (!glfwInit())
+        {
+            std::cerr << "GLFW initialization failed" << std::endl;
+            return false;
+        }
+
+        // Request OpenGL version 4.3 core profile
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        window = glfwCreateWindow(width, height, title, NULL, NULL);
+        if (!window)
+        {
+            std::cerr << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+
+        // Initialize GLEW after context creation
+        glewExperimental = GL_TRUE;
+        GLenum err = glewInit();
+        if (GLEW_OK != err)
+        {
+            std::cerr << "GLEW initialization failed: " << glewGetErrorString(err) << std::endl;
+            destroy();
+            return false;
+        }
+        return true;
+    }
+
+    void destroy()
+    {
+        if (window)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            window = nullptr;
+        }
+        if (eglDisplay != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (eglSurface != EGL_NO_SURFACE)
+            {
+                eglDestroySurface(eglDisplay, eglSurface);
+            }
+            if (eglContext != EGL_NO_CONTEXT)
+            {
+                eglDestroyContext(eglDisplay, eglContext);
+            }
+            eglTerminate(eglDisplay);
+        }
+        eglDisplay = EGL_NO_DISPLAY;
+        eglContext = EGL_NO_CONTEXT;
+        eglSurface = EGL_NO_SURFACE;
+    }
+
+private:
+    bool initializeDisplay()
+    {
+        EGLint major, minor;
+        return eglDisplay != EGL_NO_DISPLAY && eglInitialize(eglDisplay, &major, &minor);
+    }
+};
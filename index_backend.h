@@ -0,0 +1,243 @@
+#pragma once
+
+// The interface every range index implements, so KKIndex, CpuIndex and
+// BTreeIndex can be built over the same column and compared on the same
+// batches, and the driver that does the comparing.
+//
+// A backend indexes an int32 key column (and optionally a payload column)
+// owned by the caller; row identifiers are positions in that column.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "metrics.h"
+#include "query_results.h"
+
+// Runs work(0 .. numItems - 1) on up to numThreads workers
+template <typename Work>
+inline void parallelFor(size_t numItems, int numThreads, const Work &work)
+{
+    size_t numWorkers = std::min<size_t>(std::max(numThreads, 1), numItems);
+    if (numWorkers <= 1)
+    {
+        for (size_t i = 0; i < numItems; ++i)
+        {
+            work(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < numWorkers; ++w)
+    {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < numItems; i = next++)
+            {
+                work(i);
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+class IndexBackend
+{
+public:
+    const int *keys = nullptr;    // Key column, indexed by row identifier
+    const int *payload = nullptr; // Optional payload column for SUM/MIN/MAX
+    size_t numRows = 0;
+
+    virtual ~IndexBackend() {}
+
+    virtual const char *name() const = 0;
+
+    // Indexes columns owned by the caller; they must outlive the index.
+    // Returns false if the index could not be built.
+    virtual bool build(const int *keys, size_t numRows, const int *payload = nullptr) = 0;
+
+    // Answers one batch: the row identifiers of each query, in ascending
+    // order (KKIndex with ResultAllocation::Ordered returns them in key
+    // order instead). queriesAreNonOverlapping is a hint; backends that do not
+    // decompose queries ignore it. The results are reused by the next batch.
+    virtual const QueryResults &queryRows(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping) = 0;
+
+    // Bytes held by the index (host and device), not counting the indexed
+    // columns
+    virtual size_t memoryFootprint() const = 0;
+
+    // COUNT/SUM/MIN/MAX of the payload over each query's rows. By default
+    // folded from queryRows().
+    virtual std::vector<AggregateResult> queryAggregates(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping)
+    {
+        const QueryResults &rows = queryRows(queries, queriesAreNonOverlapping);
+        std::vector<AggregateResult> aggregates(queries.size(), AggregateResult{0, 0, 0, 0});
+        for (size_t q = 0; q < queries.size(); ++q)
+        {
+            AggregateResult &result = aggregates[q];
+            result.count = rows[q].size();
+            if (!this->payload || rows[q].empty())
+            {
+                continue;
+            }
+            result.min = INT_MAX;
+            result.max = INT_MIN;
+            for (int row : rows[q])
+            {
+                int value = this->payload[row];
+                result.sum += value;
+                result.min = std::min(result.min, value);
+                result.max = std::max(result.max, value);
+            }
+        }
+        return aggregates;
+    }
+
+    // Point lookups (an IN-list): the row identifiers of each probe key, in
+    // ascending order; keys may repeat. By default each probe is asked as
+    // the range [key, key + 1), so a probe of INT_MAX finds nothing.
+    virtual const QueryResults &lookupRows(const std::vector<int> &probeKeys)
+    {
+        std::vector<std::pair<int, int>> ranges(probeKeys.size());
+        for (size_t p = 0; p < probeKeys.size(); ++p)
+        {
+            int key = probeKeys[p];
+            ranges[p] = {key, key == INT_MAX ? key : key + 1};
+        }
+        return queryRows(ranges, false);
+    }
+
+    // Probes the index with numProbes keys of an outer table, the first of
+    // which is outer row firstOuterRow, and appends one (outer row, inner
+    // row) pair per match. Returns the number of pairs appended. By default
+    // the pairs come from lookupRows(), sized from its offsets before they
+    // are written.
+    virtual size_t appendJoinPairs(const int *probeKeys, size_t numProbes, int firstOuterRow, std::vector<JoinPair> &pairs)
+    {
+        const QueryResults &rows = lookupRows(std::vector<int>(probeKeys, probeKeys + numProbes));
+        size_t first = pairs.size();
+        pairs.resize(first + rows.totalRows());
+        JoinPair *out = pairs.data() + first;
+        for (size_t p = 0; p < numProbes; ++p)
+        {
+            for (int innerRow : rows[p])
+            {
+                *out++ = JoinPair{firstOuterRow + static_cast<int>(p), innerRow};
+            }
+        }
+        return rows.totalRows();
+    }
+
+    // The row identifiers of the single range [lo, hi)
+    RowSpan queryRange(int lo, int hi)
+    {
+        return queryRows({{lo, hi}}, true)[0];
+    }
+};
+
+// Builds and times one backend
+inline bool buildBackend(IndexBackend &backend, const int *keys, size_t numRows, const int *payload, double &buildTime)
+{
+    std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+    bool built = backend.build(keys, numRows, payload);
+    std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+    buildTime = elapsed.count();
+    return built;
+}
+
+// Index nested-loop join: streams the outer table's key column through the
+// index of the inner table, batchSize probes at a time, and returns the
+// (outer row, inner row) pairs of equal keys. The pairs of a batch follow
+// those of earlier batches; within a batch their order is up to the backend.
+inline std::vector<JoinPair> indexNestedLoopJoin(IndexBackend &inner, const int *outerKeys, size_t numOuterRows, size_t batchSize)
+{
+    StageTimer timer("join_time");
+    std::vector<JoinPair> pairs;
+    batchSize = std::max<size_t>(batchSize, 1);
+    size_t numBatches = 0;
+    for (size_t first = 0; first < numOuterRows; first += batchSize, ++numBatches)
+    {
+        size_t numProbes = std::min(batchSize, numOuterRows - first);
+        inner.appendJoinPairs(outerKeys + first, numProbes, static_cast<int>(first), pairs);
+    }
+    timer.stop("(" + std::to_string(numBatches) + " batches, " + std::to_string(pairs.size()) + " pairs)");
+    return pairs;
+}
+
+// Copy of results with each query's rows in ascending order, so backends
+// that return rows in key order compare equal to the others
+inline QueryResults sortedPerQuery(const QueryResults &results)
+{
+    QueryResults sorted = results;
+    for (size_t q = 0; q < sorted.size(); ++q)
+    {
+        std::sort(sorted.rows.begin() + sorted.offsets[q], sorted.rows.begin() + sorted.offsets[q + 1]);
+    }
+    return sorted;
+}
+
+// Runs the same batch on every backend (one warm-up run, then the median of
+// `repetitions` timed runs), checks that they all return the same rows as
+// the first one (in any order within a query) and prints one line per
+// backend. Returns the index of the fastest backend, or -1 if the backends
+// disagree.
+inline int compareBackends(const std::vector<IndexBackend *> &backends, const std::vector<std::pair<int, int>> &queries,
+                           bool queriesAreNonOverlapping, int repetitions = 5)
+{
+    std::vector<double> medians;
+    QueryResults reference;
+    bool agree = true;
+    for (size_t b = 0; b < backends.size(); ++b)
+    {
+        IndexBackend &backend = *backends[b];
+        QueryResults results = sortedPerQuery(backend.queryRows(queries, queriesAreNonOverlapping));
+        if (b == 0)
+        {
+            reference = results;
+        }
+        else if (results.offsets != reference.offsets || results.rows != reference.rows)
+        {
+            std::cerr << backend.name() << " disagrees with " << backends[0]->name() << std::endl;
+            agree = false;
+        }
+
+        std::vector<double> times;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+            backend.queryRows(queries, queriesAreNonOverlapping);
+            std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+            times.push_back(elapsed.count());
+        }
+        std::sort(times.begin(), times.end());
+        medians.push_back(times.empty() ? 0.0 : times[times.size() / 2]);
+    }
+
+    int fastest = 0;
+    for (size_t b = 0; b < backends.size(); ++b)
+    {
+        std::cerr << "backend " << backends[b]->name() << ": median_query_time: " << medians[b] << " ms, memory: "
+                  << backends[b]->memoryFootprint() / (1024.0 * 1024.0) << " MiB" << std::endl;
+        if (medians[b] < medians[fastest])
+        {
+            fastest = static_cast<int>(b);
+        }
+    }
+    if (!agree)
+    {
+        return -1;
+    }
+    std::cerr << "fastest backend: " << backends[fastest]->name() << std::endl;
+    return fastest;
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+// Snapshot files of a built KKIndex (.kkidx), so that a restarted process
+// maps the posting lists and uploads them instead of parsing the table and
+// building them again:
+//
+//   IndexSnapshotHeader                   (64 bytes)
+//   int32 keyOffsets[domainSize + 1]      CSR offsets, one per key slot plus one
+//   int32 rankKeys[domainSize]            rank-compressed only
+//   int32 rowIds[numRows]                 row identifiers grouped by key
+//   int32 payload[numRows]                payload in rowIds order, if any
+//
+// Every section starts on a 64-byte boundary. The checksum covers the
+// sections (not the padding) and is verified on load. The header records the
+// size and modification time of the table the index was built from, so a
+// snapshot of an older version of the table is not used.
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kIndexSnapshotMagic[8] = {'K', 'K', 'I', 'D', 'X', '\0', '\0', '\0'};
+static const uint32_t kIndexSnapshotVersion = 1;
+static const uint64_t kIndexSnapshotAlignment = 64;
+
+enum IndexSnapshotFlags : uint32_t
+{
+    kSnapshotRankCompressed = 1,
+    kSnapshotHasPayload = 2,
+};
+
+// The table an index is built from
+struct IndexSnapshotSource
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    int32_t payloadColumn = -1; // -1 without payload
+};
+
+struct IndexSnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t numRows;
+    int32_t rangeMin;
+    int32_t domainSize;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t checksum;
+    int32_t payloadColumn;
+    uint8_t reserved[4];
+};
+static_assert(sizeof(IndexSnapshotHeader) == 64, "IndexSnapshotHeader must stay 64 bytes");
+
+// Describes the table file; a missing file gets an all-zero source.
+inline IndexSnapshotSource snapshotSource(const char *tableFile, int payloadColumn)
+{
+    IndexSnapshotSource source;
+    struct stat st;
+    if (stat(tableFile, &st) == 0)
+    {
+        source.size = st.st_size;
+        source.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    source.payloadColumn = payloadColumn;
+    return source;
+}
+
+// Byte offsets of the sections, derived from the header
+struct IndexSnapshotLayout
+{
+    uint64_t keyOffsets;
+    uint64_t rankKeys; // 0 if absent
+    uint64_t rowIds;
+    uint64_t payload; // 0 if absent
+    uint64_t fileSize;
+
+    explicit IndexSnapshotLayout(const IndexSnapshotHeader &header)
+    {
+        uint64_t offset = sizeof(IndexSnapshotHeader);
+        keyOffsets = offset;
+        offset = align(offset + (static_cast<uint64_t>(header.domainSize) + 1) * sizeof(int32_t));
+        rankKeys = 0;
+        if (header.flags & kSnapshotRankCompressed)
+        {
+            rankKeys = offset;
+            offset = align(offset + static_cast<uint64_t>(header.domainSize) * sizeof(int32_t));
+        }
+        rowIds = offset;
+        offset = align(offset + header.numRows * sizeof(int32_t));
+        payload = 0;
+        if (header.flags & kSnapshotHasPayload)
+        {
+            payload = offset;
+            offset = align(offset + header.numRows * sizeof(int32_t));
+        }
+        fileSize = offset;
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + kIndexSnapshotAlignment - 1) & ~(kIndexSnapshotAlignment - 1);
+    }
+};
+
+// Folds count int32 values into a running checksum. Four interleaved pairs
+// of Fletcher-style sums (a += word, b += a) keep it at memory speed; b
+// makes it sensitive to the order of the words, not only their values.
+inline uint64_t snapshotChecksum(uint64_t checksum, const int32_t *values, uint64_t count)
+{
+    const uint32_t *words = reinterpret_cast<const uint32_t *>(values);
+    uint64_t a[4] = {0, 0, 0, 0};
+    uint64_t b[4] = {0, 0, 0, 0};
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            a[lane] += words[i + lane];
+            b[lane] += a[lane];
+        }
+    }
+    for (; i < count; ++i)
+    {
+        a[0] += words[i];
+        b[0] += a[0];
+    }
+    // FNV-1a over the lane sums and the length
+    const uint64_t prime = 1099511628211ull;
+    checksum = (checksum ^ count) * prime;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        checksum = (checksum ^ a[lane]) * prime;
+        checksum = (checksum ^ b[lane]) * prime;
+    }
+    return checksum;
+}
+
+// Checksum of the sections, in file order; absent sections are nullptr
+inline uint64_t snapshotChecksum(const IndexSnapshotHeader &header, const int32_t *keyOffsets, const int32_t *rankKeys,
+                                 const int32_t *rowIds, const int32_t *payload)
+{
+    uint64_t checksum = 14695981039346656037ull;
+    checksum = snapshotChecksum(checksum, keyOffsets, static_cast<uint64_t>(header.domainSize) + 1);
+    if (rankKeys)
+    {
+        checksum = snapshotChecksum(checksum, rankKeys, header.domainSize);
+    }
+    checksum = snapshotChecksum(checksum, rowIds, header.numRows);
+    if (payload)
+    {
+        checksum = snapshotChecksum(checksum, payload, header.numRows);
+    }
+    return checksum;
+}
+
+// Writes a snapshot. rankKeys and payload may be nullptr; keyOffsets has
+// domainSize + 1 entries, rankKeys domainSize and rowIds and payload numRows.
+inline bool writeIndexSnapshot(const char *filename, const IndexSnapshotSource &source, uint64_t numRows, int rangeMin, int domainSize,
+                               const int *keyOffsets, const int *rankKeys, const int *rowIds, const int *payload)
+{
+    IndexSnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kIndexSnapshotMagic, sizeof(header.magic));
+    header.version = kIndexSnapshotVersion;
+    header.flags = (rankKeys ? kSnapshotRankCompressed : 0) | (payload ? kSnapshotHasPayload : 0);
+    header.numRows = numRows;
+    header.rangeMin = rangeMin;
+    header.domainSize = domainSize;
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+    header.payloadColumn = payload ? source.payloadColumn : -1;
+    header.checksum = snapshotChecksum(header, keyOffsets, rankKeys, rowIds, payload);
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+
+    static const char padding[kIndexSnapshotAlignment] = {0};
+    IndexSnapshotLayout layout(header);
+    uint64_t written = 0;
+    auto writeSection = [&](uint64_t offset, const int *values, uint64_t count) {
+        file.write(padding, offset - written);
+        file.write(reinterpret_cast<const char *>(values), count * sizeof(int32_t));
+        written = offset + count * sizeof(int32_t);
+    };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    written = sizeof(header);
+    writeSection(layout.keyOffsets, keyOffsets, static_cast<uint64_t>(domainSize) + 1);
+    if (rankKeys)
+    {
+        writeSection(layout.rankKeys, rankKeys, domainSize);
+    }
+    writeSection(layout.rowIds, rowIds, numRows);
+    if (payload)
+    {
+        writeSection(layout.payload, payload, numRows);
+    }
+    file.write(padding, layout.fileSize - written);
+
+    if (!file.good())
+    {
+        std::cerr << "Failed to write index snapshot: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Read-only mmap view of a verified snapshot. The sections are used in
+// place, straight from the page cache.
+struct MappedIndexSnapshot
+{
+    void *base = nullptr;
+    size_t mappedSize = 0;
+    const IndexSnapshotHeader *header = nullptr;
+    const int *keyOffsets = nullptr;
+    const int *rankKeys = nullptr;
+    const int *rowIds = nullptr;
+    const int *payload = nullptr;
+
+    MappedIndexSnapshot() = default;
+    MappedIndexSnapshot(const MappedIndexSnapshot &) = delete;
+    MappedIndexSnapshot &operator=(const MappedIndexSnapshot &) = delete;
+
+    // Maps the file and checks its version, size and checksum. A missing
+    // file fails quietly: the caller builds the index and writes one.
+    bool open(const char *filename)
+    {
+        close();
+
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(IndexSnapshotHeader))
+        {
+            std::cerr << "Index snapshot is too small: " << filename << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            std::cerr << "Failed to mmap index snapshot: " << filename << std::endl;
+            return false;
+        }
+
+        base = mapped;
+        mappedSize = st.st_size;
+        header = static_cast<const IndexSnapshotHeader *>(base);
+
+        if (std::memcmp(header->magic, kIndexSnapshotMagic, sizeof(header->magic)) != 0 ||
+            header->version != kIndexSnapshotVersion)
+        {
+            std::cerr << "Not a version " << kIndexSnapshotVersion << " index snapshot: " << filename << std::endl;
+            close();
+            return false;
+        }
+
+        // Check the counts against the file size first, so the layout
+        // derived from them cannot overflow; rowIds are int32 on the GPU
+        if (header->domainSize <= 0 || header->numRows > mappedSize / sizeof(int32_t) ||
+            header->numRows > static_cast<uint64_t>(INT_MAX) ||
+            static_cast<uint64_t>(header->domainSize) > mappedSize / sizeof(int32_t))
+        {
+            std::cerr << "Index snapshot is truncated: " << filename << std::endl;
+            close();
+            return false;
+        }
+        IndexSnapshotLayout layout(*header);
+        if (layout.fileSize > mappedSize)
+        {
+            std::cerr << "Index snapshot is truncated: " << filename << std::endl;
+            close();
+            return false;
+        }
+        const char *bytes = static_cast<const char *>(base);
+        keyOffsets = reinterpret_cast<const int *>(bytes + layout.keyOffsets);
+        rankKeys = layout.rankKeys ? reinterpret_cast<const int *>(bytes + layout.rankKeys) : nullptr;
+        rowIds = reinterpret_cast<const int *>(bytes + layout.rowIds);
+        payload = layout.payload ? reinterpret_cast<const int *>(bytes + layout.payload) : nullptr;
+
+        // The checksum reads every page once, front to back
+        madvise(base, mappedSize, MADV_SEQUENTIAL);
+        madvise(base, mappedSize, MADV_WILLNEED);
+        if (snapshotChecksum(*header, keyOffsets, rankKeys, rowIds, payload) != header->checksum)
+        {
+            std::cerr << "Index snapshot checksum mismatch: " << filename << std::endl;
+            close();
+            return false;
+        }
+        if (keyOffsets[header->domainSize] != static_cast<int>(header->numRows))
+        {
+            std::cerr << "Index snapshot offsets do not cover its rows: " << filename << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (base)
+        {
+            munmap(base, mappedSize);
+        }
+        base = nullptr;
+        mappedSize = 0;
+        header = nullptr;
+        keyOffsets = nullptr;
+        rankKeys = nullptr;
+        rowIds = nullptr;
+        payload = nullptr;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+
+    // Whether the snapshot was built from this version of the table, with
+    // the same payload column
+    bool matches(const IndexSnapshotSource &source) const
+    {
+        return header->sourceSize == source.size && header->sourceMtime == source.mtime && header->payloadColumn == source.payloadColumn;
+    }
+
+    ~MappedIndexSnapshot() { close(); }
+};
@@ -0,0 +1,2089 @@
+#pragma once
+
+// KKIndex: a range index over one int32 key column that answers batches of
+// range queries on the GPU. Keys are laid out as CSR posting lists over a
+// dense (or rank-compressed) domain, uploaded as texture buffers in tiles,
+// and each query range is rasterized as lines so that every covered key
+// position becomes one fragment that emits its rows into a result SSBO.
+
+#include <GL/glew.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>    // For high-resolution timing
+#include <algorithm> // For std::min and std::max
+#include <set>
+#include <climits>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "index_backend.h"
+#include "index_snapshot.h"
+#include "metrics.h"
+#include "query_decomposition.h"
+#include "query_results.h"
+
+inline void checkGLError(const char *functionName)
+{
+    GLenum error;
+    while ((error = glGetError()) != GL_NO_ERROR)
+    {
+        std::cerr << "OpenGL Error after " << functionName << ": ";
+        switch (error)
+        {
+        case GL_INVALID_ENUM:
+            std::cerr << "GL_INVALID_ENUM\n";
+            break;
+        case GL_INVALID_VALUE:
+            std::cerr << "GL_INVALID_VALUE\n";
+            break;
+        case GL_INVALID_OPERATION:
+            std::cerr << "GL_INVALID_OPERATION\n";
+            break;
+        case GL_STACK_OVERFLOW:
+            std::cerr << "GL_STACK_OVERFLOW\n";
+            break;
+        case GL_STACK_UNDERFLOW:
+            std::cerr << "GL_STACK_UNDERFLOW\n";
+            break;
+        case GL_OUT_OF_MEMORY:
+            std::cerr << "GL_OUT_OF_MEMORY\n";
+            break;
+        case GL_INVALID_FRAMEBUFFER_OPERATION:
+            std::cerr << "GL_INVALID_FRAMEBUFFER_OPERATION\n";
+            break;
+        default:
+            std::cerr << "Unknown error\n";
+            break;
+        }
+    }
+}
+
+// Function to load shader code from a file
+inline std::string loadShaderCode(const char *filePath)
+{
+    std::ifstream shaderFile(filePath);
+    if (!shaderFile.is_open())
+    {
+        std::cerr << "Failed to open shader file: " << filePath << std::endl;
+        return "";
+    }
+    std::stringstream shaderStream;
+    shaderStream << shaderFile.rdbuf();
+    return shaderStream.str();
+}
+
+// Utility function to compile shader program with error checking
+inline GLuint compileShaderProgram(const char *vertexSource, const char *fragmentSource)
+{
+    // Create shaders
+    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+
+    // Set shader sources
+    glShaderSource(vertexShader, 1, &vertexSource, nullptr);
+    glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
+
+    GLint success;
+    GLchar infoLog[512];
+
+    // Compile vertex shader
+    glCompileShader(vertexShader);
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
+        std::cerr << "Error compiling vertex shader:\n"
+                  << infoLog << std::endl;
+        return 0;
+    }
+
+    // Compile fragment shader
+    glCompileShader(fragmentShader);
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
+        std::cerr << "Error compiling fragment shader:\n"
+                  << infoLog << std::endl;
+        return 0;
+    }
+
+    // Link shaders into a program
+    GLuint programID = glCreateProgram();
+    glAttachShader(programID, vertexShader);
+    glAttachShader(programID, fragmentShader);
+    glLinkProgram(programID);
+
+    // Check for linking errors
+    glGetProgramiv(programID, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
+        std::cerr << "Error linking shader program:\n"
+                  << infoLog << std::endl;
+        return 0;
+    }
+
+    // Clean up shaders as they're linked into our program now and no longer necessary
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return programID;
+}
+
+inline GLuint compileComputeProgram(const char *computeSource)
+{
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShader, 1, &computeSource, nullptr);
+
+    GLint success;
+    GLchar infoLog[512];
+    glCompileShader(computeShader);
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(computeShader, 512, nullptr, infoLog);
+        std::cerr << "Error compiling compute shader:\n"
+                  << infoLog << std::endl;
+        glDeleteShader(computeShader);
+        return 0;
+    }
+
+    GLuint programID = glCreateProgram();
+    glAttachShader(programID, computeShader);
+    glLinkProgram(programID);
+    glDeleteShader(computeShader);
+    glGetProgramiv(programID, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
+        std::cerr << "Error linking compute program:\n"
+                  << infoLog << std::endl;
+        glDeleteProgram(programID);
+        return 0;
+    }
+    return programID;
+}
+
+// Whether shaders of the given stage (GL_FRAGMENT_SHADER_BIT,
+// GL_COMPUTE_SHADER_BIT) can use subgroup arithmetic and ballot
+// (GL_KHR_shader_subgroup), for the SUBGROUP_ALLOCATION shader variants.
+inline bool subgroupAllocationSupported(GLbitfield stage)
+{
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    bool hasExtension = false;
+    for (GLint i = 0; i < numExtensions && !hasExtension; ++i)
+    {
+        hasExtension = std::string(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i))) == "GL_KHR_shader_subgroup";
+    }
+    if (!hasExtension)
+    {
+        return false;
+    }
+    GLint stages = 0;
+    GLint features = 0;
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+    const GLint needed = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR | GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+    return (stages & stage) && (features & needed) == needed;
+}
+
+// Replaces the #version line of a shader with "#version <version>" and
+// "#define <define> 1"
+inline std::string shaderVariant(const char *source, int version, const char *define)
+{
+    std::string code(source);
+    size_t versionEnd = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+    std::string header = "#version " + std::to_string(version) + "\n#define " + define + " 1\n";
+    return versionEnd == std::string::npos ? header + code : header + code.substr(versionEnd + 1);
+}
+
+inline void APIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                     GLsizei length, const GLchar *message, const void *userParam)
+{
+    std::cerr << "GL CALLBACK: " << message << std::endl;
+}
+
+// Uploads count ints into a new buffer and returns an R32I (or, e.g., RG32I
+// for pairs) texture buffer viewing it.
+inline GLuint createIntTextureBuffer(const int *data, size_t count, GLuint *bufferOut = nullptr, GLenum usage = GL_STATIC_DRAW,
+                                     GLenum internalFormat = GL_R32I)
+{
+    GLuint tbo;
+    glGenBuffers(1, &tbo);
+    if (bufferOut)
+    {
+        *bufferOut = tbo;
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, tbo);
+    glBufferData(GL_TEXTURE_BUFFER, count * sizeof(int), data, usage);
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_BUFFER, textureID);
+    glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, tbo);
+    return textureID;
+}
+
+// A StageTimer that also measures the GPU time of the stage, between two
+// GL_TIMESTAMP queries issued at construction and at stop(). Unlike
+// GL_TIME_ELAPSED queries, timestamps may nest. stop() waits for the second
+// timestamp, i.e. until the GPU has finished the stage's commands.
+class GpuStageTimer : public StageTimer
+{
+public:
+    explicit GpuStageTimer(const char *stage) : StageTimer(stage)
+    {
+        glGenQueries(2, this->timestamps);
+        glQueryCounter(this->timestamps[0], GL_TIMESTAMP);
+    }
+
+    ~GpuStageTimer()
+    {
+        glDeleteQueries(2, this->timestamps);
+    }
+
+    double stop(const std::string &detail = "")
+    {
+        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+        glQueryCounter(this->timestamps[1], GL_TIMESTAMP);
+        GLuint64 gpuStart = 0, gpuEnd = 0;
+        glGetQueryObjectui64v(this->timestamps[0], GL_QUERY_RESULT, &gpuStart);
+        glGetQueryObjectui64v(this->timestamps[1], GL_QUERY_RESULT, &gpuEnd);
+        return finish(endTime, (gpuEnd - gpuStart) / 1e6, detail);
+    }
+
+private:
+    GLuint timestamps[2];
+};
+
+// A contiguous slice of the domain that is rasterized in one pass with its
+// own posting-list textures. Local domain index = domain index - domainStart.
+struct IndexTile
+{
+    int domainStart;
+    int domainEnd;
+    int rowBase; // keyOffsets[domainStart]: rank of the tile's first row
+    GLuint keyOffsetsBuffer;
+    GLuint keyOffsetsTexture; // Offsets rebased to the tile's first row
+    GLuint rowIdsBuffer;
+    GLuint rowIdsTexture;
+    GLuint payloadBuffer;  // Payload values in rowIds order, or 0
+    GLuint payloadTexture;
+    GLuint keyEndsBuffer;  // Updatable tiles only, else 0: see TileMirror
+    GLuint keyEndsTexture;
+};
+
+// Host mirror of an updatable tile (KKIndex::updatable). Key slot k owns the
+// postings rowIds[begins[k], ends[k]), in ascending row order, with room up
+// to begins[k] + capacities[k]. A key that outgrows its room moves to the
+// end of the pool with twice the room; its old span is left unused until the
+// next build. On the GPU, begins takes the place of the CSR offsets (unit 0)
+// and ends gets its own texture (unit 3). Entries changed since the last
+// upload are tracked as ranges and pushed with glBufferSubData.
+struct TileMirror
+{
+    std::vector<int> begins;
+    std::vector<int> ends;
+    std::vector<int> capacities;
+    std::vector<int> rowIds;  // The pool; its size is the GPU buffer's
+    std::vector<int> payload; // Payload of each pool entry (with payload only)
+    int poolUsed = 0;
+    bool poolReallocated = false;               // The pool grew: upload all of it
+    std::vector<std::pair<int, int>> dirtyKeys; // [first, last) key slots
+    std::vector<std::pair<int, int>> dirtyRows; // [first, last) pool entries
+};
+
+// How the result SSBO is sized for a batch
+enum class ResultAllocation
+{
+    CountFirst, // Counting pass, exact allocation, then the materializing pass
+    Retry,      // Materialize directly; on overflow grow and draw again
+    Ordered,    // Each row goes to its rank-derived slot: key ordered, no atomics
+};
+
+// How KKIndex::query() visits the key positions of the subqueries
+enum class QueryEngine
+{
+    Raster,  // Lines rasterized into one fragment per key position (shader.fs)
+    Compute, // Workgroups over chunks of the domain ranges (shader.comp)
+};
+
+// One workgroup's share of a subquery piece (RangeChunk in shader.comp)
+struct RangeChunk
+{
+    GLint start;
+    GLint end;
+    GLint queryIndex;
+    GLint padding;
+};
+
+// Per-subquery accumulator of the aggregate mode (QueryAggregate in shader.fs)
+struct QueryAggregate
+{
+    GLuint count;
+    GLuint sumLow;
+    GLuint sumHigh;
+    GLint minValue;
+    GLint maxValue;
+};
+static_assert(sizeof(QueryAggregate) == 20, "QueryAggregate must match the std430 layout");
+
+struct LineVertex
+{
+    float x;
+    float y;
+    int queryIndex;
+};
+
+class KKIndex : public IndexBackend
+{
+public:
+    GLuint shaderProgram;
+    GLuint computeProgram = 0;
+    GLuint currentProgram = 0; // Program the uniform setters write to
+    QueryEngine engine = QueryEngine::Raster;
+    bool allowSubgroups = true;      // Use the subgroup variant of shader.fs where supported
+    bool subgroupAllocation = false; // shaderProgram reserves output once per subgroup
+    bool computeSubgroupAllocation = false; // Same for computeProgram
+    std::vector<int> keyOffsets; // CSR offsets into rowIds, one per key slot plus one
+    std::vector<int> rowIds;     // Row identifiers grouped by key
+
+    // The rasterized domain. Dense: domain index = key - rangeMin.
+    // Rank-compressed: domain index = rank of the key among rankKeys.
+    bool rankCompressed = false;
+    std::vector<int> rankKeys; // Sorted distinct keys (rank-compressed only)
+    int rangeMin = 0;
+    int domainSize = 0;
+
+    // The domain is rasterized in tiles of at most one viewport each
+    std::vector<IndexTile> tiles;
+    std::vector<int> tileStarts; // tiles[i].domainStart, for binary search
+    std::vector<std::pair<int, int>> preparedTileDraws; // (tile, vertex count) of the current batch
+    int maxTileKeys = 0;
+
+    // Incremental updates: set updatable before build() and every tile keeps
+    // a TileMirror that insertRow()/deleteRow() patch; the next batch uploads
+    // only the changed entries. Once updated, keyOffsets and rowIds no longer
+    // describe the tiles.
+    bool updatable = false;
+    bool updated = false;
+    std::vector<TileMirror> mirrors; // One per tile
+    static const int kPoolSlack = 1024; // Minimum spare pool entries per tile
+    int viewPortWidth;
+    int viewPortHeight;
+    bool screenOutput = false; // Drawing to the default framebuffer, not an FBO
+    GLuint atomicCounterBuffer = 0;
+    GLuint dataSSBO = 0;
+    int ssboCapacity = 0; // Entries the result SSBO holds; grows on demand
+    GLuint aggregateSSBO = 0;
+    size_t aggregateCapacity = 0; // QueryAggregates the aggregate SSBO holds
+    ResultAllocation resultAllocation = ResultAllocation::CountFirst;
+    QueryDecomposition lastDecomposition; // Subqueries of the current batch
+    // Ordered allocation: where each subquery's rows start in the result
+    // SSBO, plus the total; uploaded as output biases (binding 4)
+    std::vector<size_t> subqueryOutputOffsets;
+    GLuint outputBiasSSBO = 0;
+    size_t outputBiasCapacity = 0;
+    QueryResults results;                 // Row identifiers of the last batch
+    bool debug = false; // Log every generated line
+    MappedIndexSnapshot snapshot; // Set by loadSnapshot()
+
+    // Compute engine: domain positions per workgroup, and the chunks of the
+    // current batch
+    static const int kComputeChunkSize = 4096;
+    GLuint chunkSSBO = 0;
+    size_t chunkCapacity = 0;
+    GLint maxWorkGroups = 65535;
+
+    // Line vertices are written into a persistently mapped ring of
+    // kLineRingSections sections, each fenced until its draw completes.
+    static const int kLineRingSections = 3;
+    GLuint lineVAO = 0;
+    GLuint lineVBO = 0;
+    LineVertex *lineRing = nullptr;
+    size_t lineRingCapacity = 0; // Vertices per section
+    int lineRingSection = 0;
+    int lineRingFirst = 0;
+    GLsync lineRingFences[kLineRingSections] = {};
+
+    const char *name() const override
+    {
+        return this->engine == QueryEngine::Compute ? "kk-compute" : "kk-raster";
+    }
+
+    // Builds the textures and the result buffers. Compile the shaders and set
+    // up the viewport first: the viewport size decides how the domain is
+    // tiled.
+    bool build(const int *keys, size_t numRows, const int *payload = nullptr) override
+    {
+        this->keys = keys;
+        this->payload = payload;
+        this->numRows = numRows;
+        this->snapshot.close();
+        if (this->updatable && this->rankCompressed)
+        {
+            std::cerr << "A rank-compressed index cannot be updated, build a dense one." << std::endl;
+            return false;
+        }
+        if (!setUpTexture())
+        {
+            return false;
+        }
+        if (!this->dataSSBO)
+        {
+            setupDataSSBO(this->viewPortWidth * this->viewPortHeight);
+        }
+        return true;
+    }
+
+    // Writes the built index to a snapshot file (index_snapshot.h)
+    bool saveSnapshot(const char *filename, const IndexSnapshotSource &source) const
+    {
+        StageTimer timer("snapshot_save_time");
+        if (this->rowIds.size() != this->numRows || this->updated)
+        {
+            std::cerr << "Only an index built from its table can be saved." << std::endl;
+            return false;
+        }
+        std::vector<int> postingPayload;
+        if (this->payload)
+        {
+            postingPayload.resize(this->numRows);
+            for (size_t i = 0; i < this->numRows; ++i)
+            {
+                postingPayload[i] = this->payload[this->rowIds[i]];
+            }
+        }
+        bool saved = writeIndexSnapshot(filename, source, this->numRows, this->rangeMin, this->domainSize, this->keyOffsets.data(),
+                                        this->rankCompressed ? this->rankKeys.data() : nullptr, this->rowIds.data(),
+                                        this->payload ? postingPayload.data() : nullptr);
+        timer.stop("(" + std::string(filename) + ")");
+        return saved;
+    }
+
+    // Builds the index from a snapshot instead of a table: the row
+    // identifiers (and payload) are uploaded from the mapping, only the
+    // offsets are copied. Fails if the snapshot is missing, corrupt, of
+    // another version of the table or built with other options. The keys are
+    // not available afterwards, and payload points at the snapshot's payload
+    // in posting order.
+    bool loadSnapshot(const char *filename, const IndexSnapshotSource &source)
+    {
+        StageTimer timer("snapshot_load_time");
+        if (!this->snapshot.open(filename))
+        {
+            return false;
+        }
+        const IndexSnapshotHeader &header = *this->snapshot.header;
+        if (!this->snapshot.matches(source) || ((header.flags & kSnapshotRankCompressed) != 0) != this->rankCompressed)
+        {
+            std::cout << "snapshot " << filename << " is of another table or options, rebuilding" << std::endl;
+            this->snapshot.close();
+            return false;
+        }
+        this->keys = nullptr;
+        this->payload = this->snapshot.payload;
+        this->numRows = header.numRows;
+        this->rangeMin = header.rangeMin;
+        this->domainSize = header.domainSize;
+        this->keyOffsets.assign(this->snapshot.keyOffsets, this->snapshot.keyOffsets + header.domainSize + 1);
+        this->rankKeys.clear();
+        if (this->snapshot.rankKeys)
+        {
+            this->rankKeys.assign(this->snapshot.rankKeys, this->snapshot.rankKeys + header.domainSize);
+        }
+        this->rowIds.clear();
+        timer.stop("(" + std::to_string(this->numRows) + " rows)");
+
+        if (!uploadIndex(this->snapshot.rowIds, this->snapshot.payload))
+        {
+            return false;
+        }
+        if (!this->dataSSBO)
+        {
+            setupDataSSBO(this->viewPortWidth * this->viewPortHeight);
+        }
+        return true;
+    }
+
+    // Host copies of the index plus everything uploaded to the GPU
+    size_t memoryFootprint() const override
+    {
+        size_t bytes = (this->keyOffsets.capacity() + this->rowIds.capacity() + this->rankKeys.capacity()) * sizeof(int);
+        if (this->updatable)
+        {
+            for (const auto &mirror : this->mirrors)
+            {
+                // On the host and again on the GPU, apart from the capacities
+                size_t keySlots = mirror.begins.size();
+                size_t poolEntries = mirror.rowIds.size() + mirror.payload.size();
+                bytes += (2 * (2 * keySlots + poolEntries) + keySlots) * sizeof(int);
+            }
+        }
+        else
+        {
+            for (const auto &tile : this->tiles)
+            {
+                size_t tileKeys = tile.domainEnd - tile.domainStart;
+                size_t tileRows = this->keyOffsets[tile.domainEnd] - this->keyOffsets[tile.domainStart];
+                bytes += (tileKeys + 1 + tileRows * (tile.payloadTexture ? 2 : 1)) * sizeof(int);
+            }
+        }
+        bytes += static_cast<size_t>(this->ssboCapacity) * sizeof(ResultData);
+        bytes += this->aggregateCapacity * sizeof(QueryAggregate) + this->chunkCapacity * sizeof(RangeChunk);
+        bytes += kLineRingSections * this->lineRingCapacity * sizeof(LineVertex);
+        bytes += this->results.offsets.capacity() * sizeof(size_t) + this->results.rows.capacity() * sizeof(int);
+        return bytes;
+    }
+
+    void compileShaders(const char *vertexShaderCode, const char *fragmentShaderCode)
+    {
+        StageTimer timer("shader_compile_time");
+        this->shaderProgram = 0;
+        this->subgroupAllocation = false;
+        if (this->allowSubgroups && subgroupAllocationSupported(GL_FRAGMENT_SHADER_BIT))
+        {
+            // GLSL 4.50 for gl_HelperInvocation; every driver with subgroups has it
+            std::string subgroupCode = shaderVariant(fragmentShaderCode, 450, "SUBGROUP_ALLOCATION");
+            this->shaderProgram = compileShaderProgram(vertexShaderCode, subgroupCode.c_str());
+            this->subgroupAllocation = this->shaderProgram != 0;
+        }
+        if (!this->shaderProgram)
+        {
+            this->shaderProgram = compileShaderProgram(vertexShaderCode, fragmentShaderCode);
+        }
+        timer.stop(this->subgroupAllocation ? "(subgroup allocation)" : "(per-fragment allocation)");
+
+        useProgram(this->shaderProgram);
+    }
+
+    // Compiles the compute engine; the texture units match shader.fs.
+    bool compileComputeShader(const char *computeShaderCode)
+    {
+        this->computeProgram = 0;
+        this->computeSubgroupAllocation = false;
+        if (this->allowSubgroups && subgroupAllocationSupported(GL_COMPUTE_SHADER_BIT))
+        {
+            std::string subgroupCode = shaderVariant(computeShaderCode, 430, "SUBGROUP_ALLOCATION");
+            this->computeProgram = compileComputeProgram(subgroupCode.c_str());
+            this->computeSubgroupAllocation = this->computeProgram != 0;
+        }
+        if (!this->computeProgram)
+        {
+            this->computeProgram = compileComputeProgram(computeShaderCode);
+        }
+        if (!this->computeProgram)
+        {
+            return false;
+        }
+        std::cout << "compute engine: " << (this->computeSubgroupAllocation ? "subgroup" : "per-invocation") << " allocation" << std::endl;
+        glProgramUniform1i(this->computeProgram, glGetUniformLocation(this->computeProgram, "keyOffsetsBuffer"), 0);
+        glProgramUniform1i(this->computeProgram, glGetUniformLocation(this->computeProgram, "rowIdsBuffer"), 1);
+        glProgramUniform1i(this->computeProgram, glGetUniformLocation(this->computeProgram, "keyEndsBuffer"), 3);
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &this->maxWorkGroups);
+        glGenBuffers(1, &chunkSSBO);
+        return true;
+    }
+
+    void useProgram(GLuint program)
+    {
+        if (program != this->currentProgram)
+        {
+            glUseProgram(program);
+            this->currentProgram = program;
+        }
+    }
+
+    bool setUpTexture()
+    {
+        StageTimer cpuTimer("texture_setup_time (cpu)");
+        if (this->numRows == 0)
+        {
+            std::cerr << "No rows loaded, cannot build the texture." << std::endl;
+            return false;
+        }
+        int range_min = this->keys[0];
+        int range_max = this->keys[0];
+
+        for (size_t row = 0; row < this->numRows; ++row)
+        {
+            range_min = std::min(range_min, this->keys[row]);
+            range_max = std::max(range_max, this->keys[row]);
+        }
+
+        // Build the CSR posting lists: keyOffsets[index]..keyOffsets[index + 1]
+        // is the range of rowIds holding the rows with the key at that domain
+        // index, in ascending row order.
+        int textureSize;
+        if (this->rankCompressed)
+        {
+            // The domain is the sorted distinct keys, so its size is O(rows).
+            std::vector<std::pair<int, int>> sortedRows(this->numRows);
+            for (size_t row = 0; row < this->numRows; ++row)
+            {
+                sortedRows[row] = {this->keys[row], static_cast<int>(row)};
+            }
+            std::sort(sortedRows.begin(), sortedRows.end());
+
+            this->rankKeys.clear();
+            this->keyOffsets.clear();
+            this->rowIds.resize(this->numRows);
+            for (size_t i = 0; i < this->numRows; ++i)
+            {
+                if (this->rankKeys.empty() || this->rankKeys.back() != sortedRows[i].first)
+                {
+                    this->rankKeys.push_back(sortedRows[i].first);
+                    this->keyOffsets.push_back(static_cast<int>(i));
+                }
+                this->rowIds[i] = sortedRows[i].second;
+            }
+            this->keyOffsets.push_back(static_cast<int>(this->numRows));
+            textureSize = static_cast<int>(this->rankKeys.size());
+            this->rangeMin = range_min;
+
+            std::cout << "Range: [" << range_min << ", " << range_max << "], distinct keys: " << textureSize << std::endl;
+        }
+        else
+        {
+            // so that range_min and range_max are not out of the bounds.
+            // Padded in 64 bits; keys at INT_MIN or INT_MAX get no padding
+            // on that side.
+            long long paddedMin = std::max<long long>(static_cast<long long>(range_min) - 1, INT_MIN);
+            long long paddedMax = std::min<long long>(static_cast<long long>(range_max) + 1, INT_MAX);
+            long long domainSize = paddedMax - paddedMin + 1;
+            if (domainSize > INT_MAX - 1)
+            {
+                std::cerr << "Key range " << domainSize << " is too wide for a dense domain, use --rank." << std::endl;
+                return false;
+            }
+            range_min = static_cast<int>(paddedMin);
+            range_max = static_cast<int>(paddedMax);
+            textureSize = static_cast<int>(domainSize);
+            this->rangeMin = range_min;
+
+            std::cout << "Range: [" << range_min << ", " << range_max << "]" << std::endl;
+
+            // Domain index of a key is key - range_min. A counting sort
+            // keeps the row identifiers of each key in ascending order.
+            this->keyOffsets.assign(textureSize + 1, 0);
+            for (size_t row = 0; row < this->numRows; ++row)
+            {
+                int index = this->keys[row] - range_min;
+                this->keyOffsets[index + 1]++;
+            }
+            for (int index = 0; index < textureSize; ++index)
+            {
+                this->keyOffsets[index + 1] += this->keyOffsets[index];
+            }
+            this->rowIds.resize(this->numRows);
+            std::vector<int> fill(this->keyOffsets.begin(), this->keyOffsets.end() - 1);
+            for (size_t row = 0; row < this->numRows; ++row)
+            {
+                int index = this->keys[row] - range_min;
+                this->rowIds[fill[index]++] = static_cast<int>(row);
+            }
+        }
+        this->domainSize = textureSize;
+        cpuTimer.stop();
+        return uploadIndex(this->rowIds.data(), nullptr);
+    }
+
+    // Sets the uniforms and uploads the posting lists tile by tile. rows are
+    // the row identifiers grouped by key (keyOffsets indexes them); the
+    // payload is gathered from this->payload unless postingPayload already
+    // holds it in rows order.
+    bool uploadIndex(const int *rows, const int *postingPayload)
+    {
+        GpuStageTimer gpuTimer("texture_setup_time (gpu upload + binding)");
+        // Set uniform variables
+        int range_min = this->rankCompressed ? this->rankKeys.front() : this->rangeMin;
+        int range_max = this->rankCompressed ? this->rankKeys.back() : this->rangeMin + this->domainSize - 1;
+        GLint rangeMinLocation = glGetUniformLocation(this->shaderProgram, "range_min");
+        glProgramUniform1f(this->shaderProgram, rangeMinLocation, static_cast<float>(range_min));
+
+        GLint rangeMaxLocation = glGetUniformLocation(this->shaderProgram, "range_max");
+        glProgramUniform1f(this->shaderProgram, rangeMaxLocation, static_cast<float>(range_max));
+
+        GLint keyOffsetsLocation = glGetUniformLocation(shaderProgram, "keyOffsetsBuffer");
+        glProgramUniform1i(this->shaderProgram, keyOffsetsLocation, 0);
+        GLint rowIdsLocation = glGetUniformLocation(shaderProgram, "rowIdsBuffer");
+        glProgramUniform1i(this->shaderProgram, rowIdsLocation, 1);
+        GLint payloadLocation = glGetUniformLocation(shaderProgram, "payloadBuffer");
+        glProgramUniform1i(this->shaderProgram, payloadLocation, 2);
+        GLint keyEndsLocation = glGetUniformLocation(shaderProgram, "keyEndsBuffer");
+        glProgramUniform1i(this->shaderProgram, keyEndsLocation, 3);
+        GLint hasPayloadLocation = glGetUniformLocation(shaderProgram, "hasPayload");
+        glProgramUniform1i(this->shaderProgram, hasPayloadLocation, this->payload ? 1 : 0);
+
+        if (!buildTiles(rows, postingPayload))
+        {
+            return false;
+        }
+
+        gpuTimer.stop();
+
+        std::cout << "tiles: " << this->tiles.size() << std::endl;
+        std::cout << "texture size in elements: " << this->domainSize << std::endl;
+        std::cout << "texture size in bytes: " << (this->keyOffsets.size() + this->numRows) * sizeof(int) << std::endl;
+        return true;
+    }
+
+    // Split the domain into tiles that fit into one viewport pass and under
+    // GL_MAX_TEXTURE_BUFFER_SIZE, and upload each tile's slice of the posting
+    // lists (see uploadIndex). Needs the viewport to be set up.
+    bool buildTiles(const int *rows, const int *postingPayload)
+    {
+        releaseTiles();
+
+        GLint maxTextureBufferSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+        long long pixels = static_cast<long long>(this->viewPortWidth) * this->viewPortHeight;
+        // A tile of n keys needs n + 1 offsets.
+        int maxTileKeys = static_cast<int>(std::min<long long>(pixels, static_cast<long long>(maxTextureBufferSize) - 1));
+        this->maxTileKeys = maxTileKeys;
+        this->updated = false;
+        if (maxTileKeys <= 0)
+        {
+            std::cerr << "Set up the viewport before the texture." << std::endl;
+            return false;
+        }
+
+        std::vector<int> tileOffsets;
+        std::vector<int> tilePayload;
+        int tileStart = 0;
+        while (tileStart < this->domainSize)
+        {
+            int tileEnd = static_cast<int>(std::min<long long>(static_cast<long long>(tileStart) + maxTileKeys, this->domainSize));
+            // Shrink tiles whose rows do not fit into one texture buffer
+            long long rowLimit = static_cast<long long>(this->keyOffsets[tileStart]) + maxTextureBufferSize;
+            if (this->keyOffsets[tileEnd] > rowLimit)
+            {
+                auto first = this->keyOffsets.begin() + tileStart + 1;
+                auto last = this->keyOffsets.begin() + tileEnd + 1;
+                tileEnd = static_cast<int>(std::upper_bound(first, last, rowLimit) - this->keyOffsets.begin()) - 1;
+                if (tileEnd == tileStart)
+                {
+                    std::cerr << "A single key has more rows than GL_MAX_TEXTURE_BUFFER_SIZE (" << maxTextureBufferSize << ")." << std::endl;
+                    return false;
+                }
+            }
+
+            IndexTile tile;
+            tile.domainStart = tileStart;
+            tile.domainEnd = tileEnd;
+            int rowBase = this->keyOffsets[tileStart];
+            tile.rowBase = rowBase;
+            tileOffsets.assign(this->keyOffsets.begin() + tileStart, this->keyOffsets.begin() + tileEnd + 1);
+            for (int &offset : tileOffsets)
+            {
+                offset -= rowBase;
+            }
+            size_t tileRows = tileOffsets.back();
+            if (this->updatable)
+            {
+                // The same postings, with spare pool entries for inserts
+                TileMirror mirror;
+                mirror.begins.assign(tileOffsets.begin(), tileOffsets.end() - 1);
+                mirror.ends.assign(tileOffsets.begin() + 1, tileOffsets.end());
+                mirror.capacities.resize(mirror.begins.size());
+                for (size_t k = 0; k < mirror.begins.size(); ++k)
+                {
+                    mirror.capacities[k] = mirror.ends[k] - mirror.begins[k];
+                }
+                size_t slack = std::max<size_t>(tileRows / 8, kPoolSlack);
+                size_t poolSize = std::min<size_t>(tileRows + slack, maxTextureBufferSize);
+                mirror.rowIds.assign(rows + rowBase, rows + rowBase + tileRows);
+                mirror.rowIds.resize(poolSize, 0);
+                if (this->payload)
+                {
+                    mirror.payload.resize(poolSize, 0);
+                    for (size_t i = 0; i < tileRows; ++i)
+                    {
+                        mirror.payload[i] = postingPayload ? postingPayload[rowBase + i] : this->payload[mirror.rowIds[i]];
+                    }
+                }
+                mirror.poolUsed = static_cast<int>(tileRows);
+                createMirrorTextures(tile, mirror);
+                this->mirrors.push_back(std::move(mirror));
+                this->tiles.push_back(tile);
+                this->tileStarts.push_back(tileStart);
+                tileStart = tileEnd;
+                continue;
+            }
+            tile.keyOffsetsTexture = createIntTextureBuffer(tileOffsets.data(), tileOffsets.size(), &tile.keyOffsetsBuffer);
+            const int noRows = 0;
+            tile.rowIdsTexture = createIntTextureBuffer(tileRows ? rows + rowBase : &noRows, std::max<size_t>(tileRows, 1), &tile.rowIdsBuffer);
+            tile.payloadBuffer = 0;
+            tile.payloadTexture = 0;
+            tile.keyEndsBuffer = 0;
+            tile.keyEndsTexture = 0;
+            if (postingPayload && tileRows > 0)
+            {
+                tile.payloadTexture = createIntTextureBuffer(postingPayload + rowBase, tileRows, &tile.payloadBuffer);
+            }
+            else if (this->payload)
+            {
+                // Store the payload in posting-list order so the shader reads
+                // it with the same index as the row identifier.
+                tilePayload.resize(std::max<size_t>(tileRows, 1));
+                for (size_t i = 0; i < tileRows; ++i)
+                {
+                    tilePayload[i] = this->payload[rows[rowBase + i]];
+                }
+                tile.payloadTexture = createIntTextureBuffer(tilePayload.data(), tilePayload.size(), &tile.payloadBuffer);
+            }
+            this->tiles.push_back(tile);
+            this->tileStarts.push_back(tileStart);
+
+            tileStart = tileEnd;
+        }
+
+        if (!this->tiles.empty())
+        {
+            bindTile(this->tiles[0]);
+        }
+        return true;
+    }
+
+    void releaseTiles()
+    {
+        for (IndexTile &tile : this->tiles)
+        {
+            glDeleteTextures(1, &tile.keyOffsetsTexture);
+            glDeleteTextures(1, &tile.rowIdsTexture);
+            glDeleteBuffers(1, &tile.keyOffsetsBuffer);
+            glDeleteBuffers(1, &tile.rowIdsBuffer);
+            if (tile.payloadTexture)
+            {
+                glDeleteTextures(1, &tile.payloadTexture);
+                glDeleteBuffers(1, &tile.payloadBuffer);
+            }
+            if (tile.keyEndsTexture)
+            {
+                glDeleteTextures(1, &tile.keyEndsTexture);
+                glDeleteBuffers(1, &tile.keyEndsBuffer);
+            }
+        }
+        this->tiles.clear();
+        this->tileStarts.clear();
+        this->mirrors.clear();
+    }
+
+    // Creates the textures of an updatable tile from its mirror
+    void createMirrorTextures(IndexTile &tile, const TileMirror &mirror)
+    {
+        size_t keySlots = std::max<size_t>(mirror.begins.size(), 1);
+        tile.keyOffsetsTexture = createIntTextureBuffer(mirror.begins.data(), keySlots, &tile.keyOffsetsBuffer, GL_DYNAMIC_DRAW);
+        tile.keyEndsTexture = createIntTextureBuffer(mirror.ends.data(), keySlots, &tile.keyEndsBuffer, GL_DYNAMIC_DRAW);
+        tile.rowIdsTexture = createIntTextureBuffer(mirror.rowIds.data(), mirror.rowIds.size(), &tile.rowIdsBuffer, GL_DYNAMIC_DRAW);
+        tile.payloadBuffer = 0;
+        tile.payloadTexture = 0;
+        if (this->payload)
+        {
+            tile.payloadTexture = createIntTextureBuffer(mirror.payload.data(), mirror.payload.size(), &tile.payloadBuffer, GL_DYNAMIC_DRAW);
+        }
+    }
+
+    // Bind the tile's key offsets to texture unit 0, its row ids to unit 1,
+    // its payload (if any) to unit 2 and its key ends (if updatable) to unit 3
+    void bindTile(const IndexTile &tile)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, tile.keyOffsetsTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, tile.rowIdsTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, tile.payloadTexture);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_BUFFER, tile.keyEndsTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        GLint textureSizeLocation = glGetUniformLocation(this->currentProgram, "textureSize");
+        glUniform1i(textureSizeLocation, tile.domainEnd - tile.domainStart);
+        GLint hasKeyEndsLocation = glGetUniformLocation(this->currentProgram, "hasKeyEnds");
+        glUniform1i(hasKeyEndsLocation, tile.keyEndsTexture ? 1 : 0);
+        GLint tileRowBaseLocation = glGetUniformLocation(this->currentProgram, "tileRowBase");
+        glUniform1i(tileRowBaseLocation, tile.rowBase);
+    }
+
+    // Index of the tile holding a domain index
+    int tileOf(int domainIndex) const
+    {
+        return static_cast<int>(std::upper_bound(this->tileStarts.begin(), this->tileStarts.end(), domainIndex) - this->tileStarts.begin()) - 1;
+    }
+
+    // Adds row to the index under key (with its payload value, if the index
+    // has a payload). Keys outside the domain grow it. The change reaches
+    // the GPU with the next batch. Needs an updatable dense index; the cost
+    // is that of the key's postings, not of the table.
+    bool insertRow(int key, int row, int payloadValue = 0)
+    {
+        if (!this->updatable || this->tiles.empty())
+        {
+            std::cerr << "Set updatable and build the index before updating it." << std::endl;
+            return false;
+        }
+        long long offset = static_cast<long long>(key) - this->rangeMin;
+        if ((offset < 0 || offset >= this->domainSize) && !growDomain(key))
+        {
+            return false;
+        }
+        int domainIndex = key - this->rangeMin;
+        int t = tileOf(domainIndex);
+        TileMirror &mirror = this->mirrors[t];
+        int k = domainIndex - this->tiles[t].domainStart;
+
+        int *first = mirror.rowIds.data() + mirror.begins[k];
+        int *last = mirror.rowIds.data() + mirror.ends[k];
+        int *position = std::lower_bound(first, last, row);
+        if (position != last && *position == row)
+        {
+            std::cerr << "Row " << row << " is already indexed under key " << key << "." << std::endl;
+            return false;
+        }
+        int rank = static_cast<int>(position - first);
+        if (mirror.ends[k] - mirror.begins[k] == mirror.capacities[k] && !relocateKey(t, k))
+        {
+            return false;
+        }
+
+        // Keep the postings in ascending row order
+        int at = mirror.begins[k] + rank;
+        int end = mirror.ends[k];
+        std::copy_backward(mirror.rowIds.begin() + at, mirror.rowIds.begin() + end, mirror.rowIds.begin() + end + 1);
+        mirror.rowIds[at] = row;
+        if (this->payload)
+        {
+            std::copy_backward(mirror.payload.begin() + at, mirror.payload.begin() + end, mirror.payload.begin() + end + 1);
+            mirror.payload[at] = payloadValue;
+        }
+        mirror.ends[k] = end + 1;
+        mirror.dirtyRows.push_back({at, end + 1});
+        mirror.dirtyKeys.push_back({k, k + 1});
+        this->numRows++;
+        this->updated = true;
+        return true;
+    }
+
+    // Removes row from the postings of key. Returns false if it is not
+    // indexed there.
+    bool deleteRow(int key, int row)
+    {
+        if (!this->updatable || this->tiles.empty())
+        {
+            std::cerr << "Set updatable and build the index before updating it." << std::endl;
+            return false;
+        }
+        long long offset = static_cast<long long>(key) - this->rangeMin;
+        if (offset < 0 || offset >= this->domainSize)
+        {
+            return false;
+        }
+        int domainIndex = static_cast<int>(offset);
+        int t = tileOf(domainIndex);
+        TileMirror &mirror = this->mirrors[t];
+        int k = domainIndex - this->tiles[t].domainStart;
+
+        int *first = mirror.rowIds.data() + mirror.begins[k];
+        int *last = mirror.rowIds.data() + mirror.ends[k];
+        int *position = std::lower_bound(first, last, row);
+        if (position == last || *position != row)
+        {
+            return false;
+        }
+        int at = mirror.begins[k] + static_cast<int>(position - first);
+        int end = mirror.ends[k];
+        std::copy(mirror.rowIds.begin() + at + 1, mirror.rowIds.begin() + end, mirror.rowIds.begin() + at);
+        if (this->payload)
+        {
+            std::copy(mirror.payload.begin() + at + 1, mirror.payload.begin() + end, mirror.payload.begin() + at);
+        }
+        mirror.ends[k] = end - 1;
+        if (at < end - 1)
+        {
+            mirror.dirtyRows.push_back({at, end - 1});
+        }
+        mirror.dirtyKeys.push_back({k, k + 1});
+        this->numRows--;
+        this->updated = true;
+        return true;
+    }
+
+    // Moves the postings of key slot k of tile t to the end of the tile's
+    // pool with twice the room, growing the pool (geometrically) if needed.
+    bool relocateKey(int t, int k)
+    {
+        TileMirror &mirror = this->mirrors[t];
+        int count = mirror.ends[k] - mirror.begins[k];
+        int capacity = std::max(2 * mirror.capacities[k], 4);
+        size_t needed = static_cast<size_t>(mirror.poolUsed) + capacity;
+        if (needed > mirror.rowIds.size())
+        {
+            GLint maxTextureBufferSize = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+            size_t poolSize = std::min<size_t>(std::max(2 * mirror.rowIds.size(), needed), maxTextureBufferSize);
+            if (needed > poolSize)
+            {
+                std::cerr << "Tile " << t << " has outgrown GL_MAX_TEXTURE_BUFFER_SIZE (" << maxTextureBufferSize
+                          << "), rebuild the index." << std::endl;
+                return false;
+            }
+            mirror.rowIds.resize(poolSize, 0);
+            if (this->payload)
+            {
+                mirror.payload.resize(poolSize, 0);
+            }
+            mirror.poolReallocated = true;
+        }
+        int begin = mirror.poolUsed;
+        std::copy(mirror.rowIds.begin() + mirror.begins[k], mirror.rowIds.begin() + mirror.ends[k], mirror.rowIds.begin() + begin);
+        if (this->payload)
+        {
+            std::copy(mirror.payload.begin() + mirror.begins[k], mirror.payload.begin() + mirror.ends[k], mirror.payload.begin() + begin);
+        }
+        mirror.begins[k] = begin;
+        mirror.ends[k] = begin + count;
+        mirror.capacities[k] = capacity;
+        mirror.poolUsed += capacity;
+        if (count > 0)
+        {
+            mirror.dirtyRows.push_back({begin, begin + count});
+        }
+        return true;
+    }
+
+    // Widens the dense domain to hold key by adding empty tiles on the side
+    // it falls out of, at least doubling the domain so that keys arriving
+    // one past the end cost O(log n) growths, not n.
+    bool growDomain(int key)
+    {
+        long long offset = static_cast<long long>(key) - this->rangeMin;
+        bool below = offset < 0;
+        long long needed = below ? -offset : offset - this->domainSize + 1;
+        long long limit = static_cast<long long>(INT_MAX) - 1 - this->domainSize;
+        if (below)
+        {
+            limit = std::min<long long>(limit, static_cast<long long>(this->rangeMin) - INT_MIN);
+        }
+        if (needed > limit)
+        {
+            std::cerr << "Key " << key << " does not fit into a dense domain, rebuild the index with --rank." << std::endl;
+            return false;
+        }
+        int grow = static_cast<int>(std::min(std::max<long long>(needed, this->domainSize), limit));
+
+        // Empty tiles covering [first, first + grow) of the new domain
+        int first = below ? 0 : this->domainSize;
+        std::vector<IndexTile> newTiles;
+        std::vector<TileMirror> newMirrors;
+        for (long long start = 0; start < grow; start += this->maxTileKeys)
+        {
+            IndexTile tile;
+            tile.domainStart = first + static_cast<int>(start);
+            tile.domainEnd = first + static_cast<int>(std::min<long long>(start + this->maxTileKeys, grow));
+            tile.rowBase = 0;
+            TileMirror mirror;
+            int keySlots = tile.domainEnd - tile.domainStart;
+            mirror.begins.assign(keySlots, 0);
+            mirror.ends.assign(keySlots, 0);
+            mirror.capacities.assign(keySlots, 0);
+            mirror.rowIds.assign(kPoolSlack, 0);
+            if (this->payload)
+            {
+                mirror.payload.assign(kPoolSlack, 0);
+            }
+            createMirrorTextures(tile, mirror);
+            newTiles.push_back(tile);
+            newMirrors.push_back(std::move(mirror));
+        }
+
+        if (below)
+        {
+            this->rangeMin -= grow;
+            for (IndexTile &tile : this->tiles)
+            {
+                tile.domainStart += grow;
+                tile.domainEnd += grow;
+            }
+            this->tiles.insert(this->tiles.begin(), newTiles.begin(), newTiles.end());
+            this->mirrors.insert(this->mirrors.begin(), std::make_move_iterator(newMirrors.begin()), std::make_move_iterator(newMirrors.end()));
+        }
+        else
+        {
+            this->tiles.insert(this->tiles.end(), newTiles.begin(), newTiles.end());
+            this->mirrors.insert(this->mirrors.end(), std::make_move_iterator(newMirrors.begin()), std::make_move_iterator(newMirrors.end()));
+        }
+        this->domainSize += grow;
+        this->tileStarts.clear();
+        for (const IndexTile &tile : this->tiles)
+        {
+            this->tileStarts.push_back(tile.domainStart);
+        }
+        std::cout << "domain grown to [" << this->rangeMin << ", " << static_cast<long long>(this->rangeMin) + this->domainSize - 1
+                  << "], tiles: " << this->tiles.size() << std::endl;
+        return true;
+    }
+
+    // Uploads the mirror entries changed since the last upload: one
+    // glBufferSubData per run of adjacent dirty entries, or the whole pool
+    // after it grew. Runs before every batch.
+    void flushUpdates()
+    {
+        if (!this->updatable)
+        {
+            return;
+        }
+        size_t uploadedBytes = 0;
+        for (size_t t = 0; t < this->tiles.size(); ++t)
+        {
+            TileMirror &mirror = this->mirrors[t];
+            const IndexTile &tile = this->tiles[t];
+            if (mirror.dirtyKeys.empty() && mirror.dirtyRows.empty() && !mirror.poolReallocated)
+            {
+                continue;
+            }
+            for (const auto &range : mergeDirtyRanges(mirror.dirtyKeys))
+            {
+                uploadedBytes += uploadRange(tile.keyOffsetsBuffer, mirror.begins, range);
+                uploadedBytes += uploadRange(tile.keyEndsBuffer, mirror.ends, range);
+            }
+            if (mirror.poolReallocated)
+            {
+                // Same buffer objects, so the textures keep viewing them
+                glBindBuffer(GL_TEXTURE_BUFFER, tile.rowIdsBuffer);
+                glBufferData(GL_TEXTURE_BUFFER, mirror.rowIds.size() * sizeof(int), mirror.rowIds.data(), GL_DYNAMIC_DRAW);
+                uploadedBytes += mirror.rowIds.size() * sizeof(int);
+                if (this->payload)
+                {
+                    glBindBuffer(GL_TEXTURE_BUFFER, tile.payloadBuffer);
+                    glBufferData(GL_TEXTURE_BUFFER, mirror.payload.size() * sizeof(int), mirror.payload.data(), GL_DYNAMIC_DRAW);
+                    uploadedBytes += mirror.payload.size() * sizeof(int);
+                }
+            }
+            else
+            {
+                for (const auto &range : mergeDirtyRanges(mirror.dirtyRows))
+                {
+                    uploadedBytes += uploadRange(tile.rowIdsBuffer, mirror.rowIds, range);
+                    if (this->payload)
+                    {
+                        uploadedBytes += uploadRange(tile.payloadBuffer, mirror.payload, range);
+                    }
+                }
+            }
+            mirror.dirtyKeys.clear();
+            mirror.dirtyRows.clear();
+            mirror.poolReallocated = false;
+        }
+        if (uploadedBytes > 0)
+        {
+            std::cout << "update upload: " << uploadedBytes << " bytes" << std::endl;
+        }
+    }
+
+    // Sorts [first, last) ranges and joins the overlapping or adjacent ones
+    static std::vector<std::pair<int, int>> mergeDirtyRanges(std::vector<std::pair<int, int>> &ranges)
+    {
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<std::pair<int, int>> merged;
+        for (const auto &range : ranges)
+        {
+            if (!merged.empty() && range.first <= merged.back().second)
+            {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else
+            {
+                merged.push_back(range);
+            }
+        }
+        return merged;
+    }
+
+    static size_t uploadRange(GLuint buffer, const std::vector<int> &values, const std::pair<int, int> &range)
+    {
+        size_t bytes = static_cast<size_t>(range.second - range.first) * sizeof(int);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, range.first * sizeof(int), bytes, values.data() + range.first);
+        return bytes;
+    }
+
+    void setuptFrameBuffersAndViewPort(int width, int height, bool useFBO)
+    {
+        this->viewPortWidth = width;
+        this->viewPortHeight = height;
+
+        GpuStageTimer timer("framebuffer_setup_time");
+
+        // Set viewport
+        glViewport(0, 0, width, height);
+        checkGLError("glViewport");
+        // Pass the projection matrix to your shader
+        glm::mat4 projectionMatrix = glm::ortho(
+            static_cast<float>(0),
+            static_cast<float>(width),
+            static_cast<float>(0),
+            static_cast<float>(height),
+            -1.0f, 1.0f // Near and Far planes
+        );
+
+        GLint projMatrixLocation = glGetUniformLocation(this->shaderProgram, "projectionMatrix");
+        glProgramUniformMatrix4fv(this->shaderProgram, projMatrixLocation, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+
+        GLint viewportWidthLocation = glGetUniformLocation(shaderProgram, "viewportWidth");
+        glProgramUniform1i(this->shaderProgram, viewportWidthLocation, width);
+
+        // Optionally set FBO.
+        if (useFBO)
+        {
+            unsigned int framebuffer;
+            glGenFramebuffers(1, &framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+            unsigned int colorTexture;
+            glGenTextures(1, &colorTexture);
+            glBindTexture(GL_TEXTURE_2D, colorTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        }
+        GLint invertYLocation = glGetUniformLocation(this->shaderProgram, "screen");
+        glProgramUniform1i(this->shaderProgram, invertYLocation, useFBO ? 0 : 1);
+        this->screenOutput = !useFBO;
+
+        timer.stop();
+    }
+
+    // Make sure every ring section holds at least numVertices line vertices.
+    // The ring lives in persistently mapped, coherent buffer storage and the
+    // VAO is created once; growing reallocates the storage.
+    void reserveLineRing(size_t numVertices)
+    {
+        if (this->lineVAO == 0)
+        {
+            glGenVertexArrays(1, &this->lineVAO);
+        }
+        if (numVertices <= this->lineRingCapacity)
+        {
+            return;
+        }
+
+        // The GPU may still read the old storage.
+        for (GLsync &fence : this->lineRingFences)
+        {
+            if (fence)
+            {
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+        if (this->lineVBO != 0)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->lineVBO);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glDeleteBuffers(1, &this->lineVBO);
+        }
+
+        this->lineRingCapacity = std::max(numVertices, std::max<size_t>(2 * this->lineRingCapacity, 4096));
+        GLsizeiptr ringBytes = sizeof(LineVertex) * this->lineRingCapacity * kLineRingSections;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glBindVertexArray(this->lineVAO);
+        glGenBuffers(1, &this->lineVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->lineVBO);
+        glBufferStorage(GL_ARRAY_BUFFER, ringBytes, nullptr, flags);
+        this->lineRing = (LineVertex *)glMapBufferRange(GL_ARRAY_BUFFER, 0, ringBytes, flags);
+        if (!this->lineRing)
+        {
+            std::cerr << "Failed to map the line vertex ring." << std::endl;
+            this->lineRingCapacity = 0;
+        }
+
+        // Specify the layout of the vertex data
+        glEnableVertexAttribArray(0); // For data_x
+        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void *)offsetof(LineVertex, x));
+
+        glEnableVertexAttribArray(1); // For data_y
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void *)offsetof(LineVertex, y));
+
+        glEnableVertexAttribArray(2); // For queryIndex
+        glVertexAttribIPointer(2, 1, GL_INT, sizeof(LineVertex), (void *)offsetof(LineVertex, queryIndex));
+
+        std::cout << "line ring capacity: " << this->lineRingCapacity << " vertices per section" << std::endl;
+    }
+
+    // Number of line vertices createLinesForQueries() emits for a query:
+    // one line per viewport row it touches.
+    int lineVertexCount(const Subquery &query) const
+    {
+        if (query.end <= query.start)
+        {
+            return 0; // Nothing to rasterize
+        }
+        return 2 * (query.end / this->viewPortWidth - query.start / this->viewPortWidth + 1);
+    }
+
+    // Writes the line vertices of the queries into the next ring section and
+    // returns the number of vertices. lineRingFirst is the first vertex to
+    // draw; call fenceLineRing() after the draw.
+    int createLinesForQueries(const std::vector<Subquery> &queries)
+    {
+        StageTimer timer("line_creation_time");
+
+        // Each query covers rows start_y..end_y, one line per row.
+        size_t numVertices = 0;
+        for (const auto &query : queries)
+        {
+            if (query.end < query.start)
+            {
+                std::cerr << "query_x2 should be greater than query_x1" << std::endl;
+                return -1;
+            }
+            numVertices += lineVertexCount(query);
+        }
+
+        LineVertex *out = nextLineRingSection(numVertices);
+        if (!out)
+        {
+            return -1;
+        }
+
+        for (const auto &query : queries)
+        {
+            int query_x1 = query.start;
+            int query_x2 = query.end;
+            int queryIndex = query.queryIndex;
+            if (query_x1 == query_x2)
+            {
+                continue;
+            }
+
+            // Calculate starting and ending points
+            int start_y = static_cast<int>(query_x1 / this->viewPortWidth) + 1;
+            int start_x = static_cast<int>(query_x1 - (start_y - 1) * this->viewPortWidth);
+            int end_y = static_cast<int>(query_x2 / this->viewPortWidth) + 1;
+            int end_x = static_cast<int>(query_x2 - (end_y - 1) * this->viewPortWidth);
+
+            // Iterate from start_y to end_y to create lines
+            for (int y = start_y; y <= end_y; ++y)
+            {
+                LineVertex startVertex, endVertex;
+
+                // Determine the x-coordinates for the current line
+                if (y == start_y)
+                {
+                    startVertex.x = static_cast<float>(start_x);
+                    endVertex.x = static_cast<float>((y == end_y) ? end_x : this->viewPortWidth);
+                }
+                else if (y == end_y)
+                {
+                    startVertex.x = 0.0f;
+                    endVertex.x = static_cast<float>(end_x);
+                }
+                else
+                {
+                    startVertex.x = 0.0f;
+                    endVertex.x = static_cast<float>(this->viewPortWidth);
+                }
+
+                // Assign y-coordinates and query index
+                startVertex.y = static_cast<float>(y);
+                endVertex.y = static_cast<float>(y);
+                startVertex.queryIndex = queryIndex;
+                endVertex.queryIndex = queryIndex;
+
+                // Write the vertices straight into the mapped ring
+                *out++ = startVertex;
+                *out++ = endVertex;
+
+                if (this->debug)
+                {
+                    std::cout << "Line [" << startVertex.x << ", " << startVertex.y << ", " << startVertex.queryIndex << "] -> "
+                              << "[ " << endVertex.x << ", " << endVertex.y << ", " << endVertex.queryIndex << "] " << std::endl;
+                }
+            }
+        }
+
+        timer.stop();
+        std::cout << "no. of lines: " << numVertices << std::endl;
+
+        glBindVertexArray(this->lineVAO);
+        return static_cast<int>(numVertices);
+    }
+
+    // Moves to the next ring section, sized for numVertices, once the GPU is
+    // done with it, and returns where to write; lineRingFirst is its first
+    // vertex.
+    LineVertex *nextLineRingSection(size_t numVertices)
+    {
+        reserveLineRing(numVertices);
+        if (!this->lineRing)
+        {
+            return nullptr;
+        }
+
+        // Wait until the GPU is done with the section we are about to overwrite
+        this->lineRingSection = (this->lineRingSection + 1) % kLineRingSections;
+        GLsync &fence = this->lineRingFences[this->lineRingSection];
+        if (fence)
+        {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        this->lineRingFirst = static_cast<int>(this->lineRingSection * this->lineRingCapacity);
+        return this->lineRing + this->lineRingFirst;
+    }
+
+    // Marks the current ring section as in use by the draw just issued.
+    // A section drawn more than once (counting and materializing passes)
+    // keeps only the newest fence, which also covers the earlier draws.
+    void fenceLineRing()
+    {
+        GLsync &fence = this->lineRingFences[this->lineRingSection];
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void setupDataSSBO(int size)
+    {
+        GpuStageTimer timer("data_ssbo_setup_time");
+        this->ssboCapacity = size;
+        glGenBuffers(1, &dataSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
+
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(ResultData), nullptr, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dataSSBO);
+
+        glGenBuffers(1, &atomicCounterBuffer);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
+
+        // Allocate storage for the atomic counter (initialize to zero)
+        GLuint zero = 0;
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
+        // Bind the atomic counter buffer to binding point 1 (matching the shader)
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, atomicCounterBuffer);
+
+        // Sized by queryAggregates() and ordered queries on first use
+        glGenBuffers(1, &aggregateSSBO);
+        glGenBuffers(1, &outputBiasSSBO);
+        timer.stop();
+    }
+
+    // Clips the (domain space) subqueries to the tiles they overlap; the
+    // pieces are tile relative.
+    std::vector<std::vector<Subquery>> splitIntoTiles(const std::vector<Subquery> &subqueries) const
+    {
+        std::vector<std::vector<Subquery>> tilePieces(this->tiles.size());
+        for (const auto &subquery : subqueries)
+        {
+            if (subquery.end <= subquery.start)
+            {
+                continue;
+            }
+            int firstTile = tileOf(subquery.start);
+            int lastTile = tileOf(subquery.end - 1);
+            for (int t = firstTile; t <= lastTile; ++t)
+            {
+                const IndexTile &tile = this->tiles[t];
+                Subquery piece;
+                piece.start = std::max(subquery.start, tile.domainStart) - tile.domainStart;
+                piece.end = std::min(subquery.end, tile.domainEnd) - tile.domainStart;
+                piece.queryIndex = subquery.queryIndex;
+                tilePieces[t].push_back(piece);
+            }
+        }
+        return tilePieces;
+    }
+
+    // Prepare the subqueries for rasterization: the line vertices of all
+    // tile pieces are written tile by tile into one ring section. Tiles no
+    // query touches get no pass.
+    bool prepareTileDraws(const std::vector<Subquery> &subqueries)
+    {
+        flushUpdates();
+        std::vector<std::vector<Subquery>> tilePieces = splitIntoTiles(subqueries);
+
+        // Lay the pieces out tile by tile so one ring section holds the batch
+        std::vector<Subquery> pieces;
+        std::vector<std::pair<int, int>> &tileDraws = this->preparedTileDraws;
+        tileDraws.clear();
+        for (size_t t = 0; t < tilePieces.size(); ++t)
+        {
+            int vertices = 0;
+            for (const auto &piece : tilePieces[t])
+            {
+                vertices += lineVertexCount(piece);
+                pieces.push_back(piece);
+            }
+            if (vertices > 0)
+            {
+                tileDraws.push_back({static_cast<int>(t), vertices});
+            }
+        }
+
+        int lines = createLinesForQueries(pieces);
+        std::cout << "tile passes: " << tileDraws.size() << " of " << this->tiles.size() << std::endl;
+        return lines >= 0;
+    }
+
+    // Issue one pass per prepared tile. May be called several times for the
+    // same preparation, e.g. a counting pass and a materializing pass.
+    void drawPreparedTiles(GLenum mode = GL_LINES)
+    {
+        int first = this->lineRingFirst;
+        for (const auto &tileDraw : this->preparedTileDraws)
+        {
+            bindTile(this->tiles[tileDraw.first]);
+            glDrawArrays(mode, first, tileDraw.second);
+            first += tileDraw.second;
+        }
+        fenceLineRing();
+    }
+
+    // Prepare the subqueries for the compute engine: every tile piece is
+    // cut into chunks of kComputeChunkSize positions, one workgroup each,
+    // and the chunks of all tiles are uploaded in one buffer.
+    // preparedTileDraws holds (tile, chunk count).
+    bool prepareTileDispatches(const std::vector<Subquery> &subqueries)
+    {
+        flushUpdates();
+        std::vector<std::vector<Subquery>> tilePieces = splitIntoTiles(subqueries);
+        std::vector<RangeChunk> chunks;
+        std::vector<std::pair<int, int>> &tileDispatches = this->preparedTileDraws;
+        tileDispatches.clear();
+        for (size_t t = 0; t < tilePieces.size(); ++t)
+        {
+            size_t firstChunk = chunks.size();
+            for (const auto &piece : tilePieces[t])
+            {
+                for (int start = piece.start; start < piece.end; start += kComputeChunkSize)
+                {
+                    chunks.push_back(RangeChunk{start, std::min(piece.end, start + kComputeChunkSize), piece.queryIndex, 0});
+                }
+            }
+            if (chunks.size() > firstChunk)
+            {
+                tileDispatches.push_back({static_cast<int>(t), static_cast<int>(chunks.size() - firstChunk)});
+            }
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunkSSBO);
+        if (chunks.size() > this->chunkCapacity)
+        {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, chunks.size() * sizeof(RangeChunk), chunks.data(), GL_DYNAMIC_DRAW);
+            this->chunkCapacity = chunks.size();
+        }
+        else if (!chunks.empty())
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, chunks.size() * sizeof(RangeChunk), chunks.data());
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, chunkSSBO);
+        std::cout << "tile dispatches: " << tileDispatches.size() << " of " << this->tiles.size() << ", chunks: " << chunks.size() << std::endl;
+        return true;
+    }
+
+    // Issue the dispatches of every prepared tile, split to stay within the
+    // workgroup count limit.
+    void dispatchPreparedTiles()
+    {
+        GLint chunkBaseLocation = glGetUniformLocation(this->computeProgram, "chunkBase");
+        int first = 0;
+        for (const auto &tileDispatch : this->preparedTileDraws)
+        {
+            bindTile(this->tiles[tileDispatch.first]);
+            for (int done = 0; done < tileDispatch.second; done += this->maxWorkGroups)
+            {
+                glUniform1i(chunkBaseLocation, first + done);
+                glDispatchCompute(std::min(tileDispatch.second - done, this->maxWorkGroups), 1, 1);
+            }
+            first += tileDispatch.second;
+        }
+        // Make the counter and result writes visible to the host reads
+        glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    bool prepareTiles(const std::vector<Subquery> &subqueries)
+    {
+        return this->engine == QueryEngine::Compute ? prepareTileDispatches(subqueries) : prepareTileDraws(subqueries);
+    }
+
+    void runPreparedTiles()
+    {
+        if (this->engine == QueryEngine::Compute)
+        {
+            dispatchPreparedTiles();
+        }
+        else
+        {
+            drawPreparedTiles();
+        }
+    }
+
+    void resetCounter()
+    {
+        GLuint zero = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+    }
+
+    // Reads the atomic counter; waits for the draws writing it.
+    GLuint readCounter()
+    {
+        GLuint value = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
+        // Map the buffer to read the counter value
+        GLuint *counterValue = (GLuint *)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+        if (counterValue)
+        {
+            value = *counterValue;
+            glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+        }
+        else
+        {
+            // Handle error
+            std::cerr << "Failed to map atomic counter buffer for reading." << std::endl;
+        }
+        return value;
+    }
+
+    void setCountOnly(bool countOnly)
+    {
+        GLint countOnlyLocation = glGetUniformLocation(this->currentProgram, "countOnly");
+        glUniform1i(countOnlyLocation, countOnly ? 1 : 0);
+    }
+
+    // Ordered allocation needs keyOffsets to describe the tiles, so an
+    // updated index falls back to CountFirst until the next build
+    bool orderedOutput() const
+    {
+        return this->resultAllocation == ResultAllocation::Ordered && !this->updated;
+    }
+
+    void setOrdered(bool ordered)
+    {
+        GLint orderedLocation = glGetUniformLocation(this->currentProgram, "ordered");
+        glUniform1i(orderedLocation, ordered ? 1 : 0);
+    }
+
+    // Lays out the ordered output of the current batch. keyOffsets is the
+    // prefix sum of key occupancy, so a subquery [start, end) has
+    // keyOffsets[end] - keyOffsets[start] rows, and the row at rank r goes
+    // to its subquery's first slot plus r - keyOffsets[start]. The shaders
+    // get that as one bias per subquery. Returns the number of entries.
+    size_t prepareOrderedOutput(const std::vector<Subquery> &subqueries)
+    {
+        std::vector<int> outputBias(std::max<size_t>(subqueries.size(), 1), 0);
+        this->subqueryOutputOffsets.resize(subqueries.size() + 1);
+        size_t total = 0;
+        for (size_t s = 0; s < subqueries.size(); ++s)
+        {
+            const Subquery &subquery = subqueries[s];
+            this->subqueryOutputOffsets[s] = total;
+            if (subquery.end > subquery.start)
+            {
+                outputBias[s] = static_cast<int>(static_cast<long long>(total) - this->keyOffsets[subquery.start]);
+                total += this->keyOffsets[subquery.end] - this->keyOffsets[subquery.start];
+            }
+        }
+        this->subqueryOutputOffsets[subqueries.size()] = total;
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->outputBiasSSBO);
+        if (outputBias.size() > this->outputBiasCapacity)
+        {
+            glBufferData(GL_SHADER_STORAGE_BUFFER, outputBias.size() * sizeof(int), outputBias.data(), GL_DYNAMIC_DRAW);
+            this->outputBiasCapacity = outputBias.size();
+        }
+        else
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, outputBias.size() * sizeof(int), outputBias.data());
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, this->outputBiasSSBO);
+        return total;
+    }
+
+    // Grow-only result pool: reallocates the SSBO only when a batch needs
+    // more entries than it holds, and then only to what is needed (rounded
+    // up to whole pages of entries).
+    void ensureResultCapacity(size_t entries)
+    {
+        if (entries <= static_cast<size_t>(this->ssboCapacity))
+        {
+            return;
+        }
+        const size_t entriesPerPage = 4096 / sizeof(ResultData);
+        size_t capacity = (entries + entriesPerPage - 1) / entriesPerPage * entriesPerPage;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(ResultData), nullptr, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dataSSBO);
+        this->ssboCapacity = static_cast<int>(capacity);
+        std::cout << "result buffer grown to " << capacity << " entries" << std::endl;
+    }
+
+    // Builds the domain space subqueries of a batch into lastDecomposition.
+    void buildSubqueries(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping)
+    {
+        StageTimer timer("decomposition_time");
+        if (queriesAreNonOverlapping) {
+            // Directly convert queries to subqueries without decomposition
+            lastDecomposition = directSubqueries(queries);
+        } else {
+            // Perform decomposition for overlapping queries
+            lastDecomposition = decomposeQueries(queries);
+        }
+
+        // Move the subqueries from key space into domain space
+        for (auto &subquery : lastDecomposition.subqueries)
+        {
+            translateRange(subquery.start, subquery.end, subquery.start, subquery.end);
+        }
+        timer.stop("(" + std::to_string(lastDecomposition.subqueries.size()) + " subqueries)");
+    }
+
+    // Runs one batch on the selected engine; the results are left in the
+    // result SSBO. Returns the number of entries written.
+    int query(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping)
+    {
+        GpuStageTimer timer("query_time");
+
+        useProgram(this->engine == QueryEngine::Compute ? this->computeProgram : this->shaderProgram);
+        buildSubqueries(queries, queriesAreNonOverlapping);
+        if (!prepareTiles(lastDecomposition.subqueries))
+        {
+            timer.stop("(tile preparation failed)");
+            return 0;
+        }
+
+        GLuint totalEntries = 0;
+        setOrdered(orderedOutput());
+        if (orderedOutput())
+        {
+            // Sizes come from the host's occupancy prefix sum: one pass, no
+            // counter
+            totalEntries = static_cast<GLuint>(prepareOrderedOutput(lastDecomposition.subqueries));
+            ensureResultCapacity(totalEntries);
+            runPreparedTiles();
+            glFinish();
+            timer.stop();
+            return static_cast<int>(totalEntries);
+        }
+        if (this->resultAllocation == ResultAllocation::CountFirst)
+        {
+            // Counting pass: fragments only add their row counts
+            resetCounter();
+            setCountOnly(true);
+            runPreparedTiles();
+            totalEntries = readCounter();
+            ensureResultCapacity(totalEntries);
+            setCountOnly(false);
+        }
+
+        // Materializing pass. Writes beyond the SSBO are dropped by the shader.
+        resetCounter();
+        runPreparedTiles();
+        totalEntries = readCounter();
+
+        if (this->resultAllocation == ResultAllocation::Retry && totalEntries > static_cast<GLuint>(this->ssboCapacity))
+        {
+            // Overflowed: the counter holds the exact size, so one retry fits
+            std::cout << "result buffer overflow (" << totalEntries << " > " << this->ssboCapacity << "), retrying" << std::endl;
+            ensureResultCapacity(totalEntries);
+            resetCounter();
+            runPreparedTiles();
+            totalEntries = readCounter();
+        }
+
+        glFinish();
+        timer.stop();
+
+        return static_cast<int>(totalEntries);
+    }
+
+    ResultData *getSSBOData()
+    {
+        GpuStageTimer timer("ssbo_read_time");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
+        ResultData *ssboData = (ResultData *)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+        timer.stop();
+        if (!ssboData)
+        {
+            std::cerr << "Failed to map SSBO for reading." << std::endl;
+        }
+        return ssboData;
+    }
+
+    // Translate the key range [start, end) into the domain index range
+    // [domainStart, domainEnd), clamped to the domain.
+    void translateRange(int start, int end, int &domainStart, int &domainEnd) const
+    {
+        if (this->rankCompressed)
+        {
+            domainStart = static_cast<int>(std::lower_bound(this->rankKeys.begin(), this->rankKeys.end(), start) - this->rankKeys.begin());
+            domainEnd = static_cast<int>(std::lower_bound(this->rankKeys.begin(), this->rankKeys.end(), end) - this->rankKeys.begin());
+        }
+        else
+        {
+            long long offsetStart = static_cast<long long>(start) - this->rangeMin;
+            long long offsetEnd = static_cast<long long>(end) - this->rangeMin;
+            domainStart = static_cast<int>(std::min<long long>(std::max<long long>(offsetStart, 0), this->domainSize));
+            domainEnd = static_cast<int>(std::min<long long>(std::max<long long>(offsetEnd, 0), this->domainSize));
+        }
+        domainEnd = std::max(domainStart, domainEnd);
+    }
+
+    void releaseSSBOData()
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+
+    // Runs one batch and returns the row identifiers of each original query,
+    // in ascending order, or in key order with ResultAllocation::Ordered.
+    // The returned results are reused by the next batch.
+    const QueryResults &queryRows(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping) override
+    {
+        int totalEntries = query(queries, queriesAreNonOverlapping);
+        ResultData *ssboData = getSSBOData();
+        if (!ssboData)
+        {
+            this->results.offsets.assign(queries.size() + 1, 0);
+            this->results.rows.clear();
+            return this->results;
+        }
+
+        StageTimer timer("result_assembly_time");
+        if (orderedOutput())
+        {
+            assembleOrderedResults(ssboData, this->subqueryOutputOffsets, lastDecomposition, queries.size(), this->results);
+        }
+        else
+        {
+            size_t availableEntries = std::min(totalEntries, ssboCapacity);
+            assembleQueryResults(ssboData, availableEntries, lastDecomposition, queries.size(), this->results);
+        }
+        releaseSSBOData();
+        timer.stop();
+        return this->results;
+    }
+
+    // Runs a batch of point lookups; the results are left in the result
+    // SSBO, the query index of an entry being its probe. Each probe is
+    // translated to its exact domain index and drawn as one GL_POINTS vertex
+    // on that index's pixel, so there is no decomposition and no line
+    // splitting. Always runs on the raster engine, with CountFirst
+    // allocation. Returns the number of entries written.
+    int lookup(const int *probeKeys, size_t numProbes)
+    {
+        GpuStageTimer timer("lookup_time");
+
+        // (domain index, probe) of every probe whose key is in the domain
+        std::vector<std::pair<int, int>> hits;
+        hits.reserve(numProbes);
+        for (size_t p = 0; p < numProbes; ++p)
+        {
+            int key = probeKeys[p];
+            if (this->rankCompressed)
+            {
+                auto rank = std::lower_bound(this->rankKeys.begin(), this->rankKeys.end(), key);
+                if (rank != this->rankKeys.end() && *rank == key)
+                {
+                    hits.push_back({static_cast<int>(rank - this->rankKeys.begin()), static_cast<int>(p)});
+                }
+            }
+            else
+            {
+                long long offset = static_cast<long long>(key) - this->rangeMin;
+                if (offset >= 0 && offset < this->domainSize)
+                {
+                    hits.push_back({static_cast<int>(offset), static_cast<int>(p)});
+                }
+            }
+        }
+        // In domain order, so the points come tile by tile and each tile's
+        // points sweep its pixels in order, as lines from decomposed ranges do
+        std::sort(hits.begin(), hits.end());
+
+        useProgram(this->shaderProgram);
+        flushUpdates();
+        std::vector<std::pair<int, int>> &tileDraws = this->preparedTileDraws;
+        tileDraws.clear();
+        LineVertex *points = !hits.empty() && !this->tiles.empty() ? nextLineRingSection(hits.size()) : nullptr;
+        if (points)
+        {
+            StageTimer pointTimer("point_creation_time");
+            // Pixel centres, on the rows the line vertices of createLinesForQueries
+            // would cover
+            float rowOffset = this->screenOutput ? 1.5f : 0.5f;
+            int t = -1;
+            for (const auto &hit : hits)
+            {
+                if (t < 0 || hit.first >= this->tiles[t].domainEnd)
+                {
+                    t = tileOf(hit.first);
+                    tileDraws.push_back({t, 0});
+                }
+                int local = hit.first - this->tiles[t].domainStart;
+                LineVertex &point = *points++;
+                point.x = static_cast<float>(local % this->viewPortWidth) + 0.5f;
+                point.y = static_cast<float>(local / this->viewPortWidth) + rowOffset;
+                point.queryIndex = hit.second;
+                tileDraws.back().second++;
+            }
+            glBindVertexArray(this->lineVAO);
+            pointTimer.stop("(" + std::to_string(hits.size()) + " points)");
+        }
+        std::cout << "lookup probes: " << numProbes << ", in domain: " << hits.size() << ", tile passes: " << tileDraws.size() << " of "
+                  << this->tiles.size() << std::endl;
+
+        GLuint totalEntries = 0;
+        if (points)
+        {
+            setOrdered(false);
+            resetCounter();
+            setCountOnly(true);
+            drawPreparedTiles(GL_POINTS);
+            totalEntries = readCounter();
+            ensureResultCapacity(totalEntries);
+            setCountOnly(false);
+
+            resetCounter();
+            drawPreparedTiles(GL_POINTS);
+            totalEntries = readCounter();
+            glFinish();
+        }
+        timer.stop();
+        return static_cast<int>(totalEntries);
+    }
+
+    // Runs a batch of point lookups (an IN-list) and returns the row
+    // identifiers of each probe key, in ascending order; a key may be probed
+    // more than once. The returned results are reused by the next batch.
+    const QueryResults &lookupRows(const std::vector<int> &probeKeys) override
+    {
+        const size_t numProbes = probeKeys.size();
+        int totalEntries = lookup(probeKeys.data(), numProbes);
+
+        ResultData *ssboData = totalEntries > 0 ? getSSBOData() : nullptr;
+        if (!ssboData)
+        {
+            this->results.offsets.assign(numProbes + 1, 0);
+            this->results.rows.clear();
+            return this->results;
+        }
+        StageTimer timer("result_assembly_time");
+        size_t availableEntries = std::min<size_t>(totalEntries, ssboCapacity);
+        assembleProbeResults(ssboData, availableEntries, numProbes, this->results);
+        releaseSSBOData();
+        timer.stop();
+        return this->results;
+    }
+
+    // Looks up one batch of outer keys and appends its pairs straight from
+    // the result SSBO: every entry already is (probe, inner row), sized by
+    // the counting pass, so nothing is grouped or sorted.
+    size_t appendJoinPairs(const int *probeKeys, size_t numProbes, int firstOuterRow, std::vector<JoinPair> &pairs) override
+    {
+        int totalEntries = lookup(probeKeys, numProbes);
+        ResultData *ssboData = totalEntries > 0 ? getSSBOData() : nullptr;
+        if (!ssboData)
+        {
+            return 0;
+        }
+        StageTimer timer("pair_copy_time");
+        size_t numPairs = std::min(totalEntries, ssboCapacity);
+        size_t first = pairs.size();
+        pairs.resize(first + numPairs);
+        JoinPair *out = pairs.data() + first;
+        for (size_t i = 0; i < numPairs; ++i)
+        {
+            out[i] = JoinPair{firstOuterRow + ssboData[i].queryIndex, ssboData[i].rowIdentifier};
+        }
+        releaseSSBOData();
+        timer.stop("(" + std::to_string(numPairs) + " pairs)");
+        return numPairs;
+    }
+
+    // Runs one batch in aggregate mode: every fragment folds its rows into
+    // the aggregate of its subquery, so only one QueryAggregate per subquery
+    // is read back instead of the matching rows. Always runs on the raster
+    // engine.
+    std::vector<AggregateResult> queryAggregates(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping) override
+    {
+        GpuStageTimer timer("aggregate_time");
+        std::vector<AggregateResult> results(queries.size(), AggregateResult{0, 0, INT_MAX, INT_MIN});
+
+        useProgram(this->shaderProgram);
+        buildSubqueries(queries, queriesAreNonOverlapping);
+        size_t numSubqueries = lastDecomposition.subqueries.size();
+        if (numSubqueries > 0 && prepareTileDraws(lastDecomposition.subqueries))
+        {
+            std::vector<QueryAggregate> aggregates(numSubqueries, QueryAggregate{0, 0, 0, INT_MAX, INT_MIN});
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, aggregateSSBO);
+            if (numSubqueries > this->aggregateCapacity)
+            {
+                glBufferData(GL_SHADER_STORAGE_BUFFER, numSubqueries * sizeof(QueryAggregate), aggregates.data(), GL_DYNAMIC_COPY);
+                this->aggregateCapacity = numSubqueries;
+            }
+            else
+            {
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numSubqueries * sizeof(QueryAggregate), aggregates.data());
+            }
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, aggregateSSBO, 0, numSubqueries * sizeof(QueryAggregate));
+
+            setAggregate(true);
+            drawPreparedTiles();
+            setAggregate(false);
+
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numSubqueries * sizeof(QueryAggregate), aggregates.data());
+
+            // Fold each subquery into the original queries it belongs to
+            for (size_t i = 0; i < numSubqueries; ++i)
+            {
+                const QueryAggregate &aggregate = aggregates[i];
+                if (aggregate.count == 0)
+                {
+                    continue;
+                }
+                int64_t sum = static_cast<int64_t>((static_cast<uint64_t>(aggregate.sumHigh) << 32) | aggregate.sumLow);
+                for (const int *member = lastDecomposition.membersBegin(i); member != lastDecomposition.membersEnd(i); ++member)
+                {
+                    AggregateResult &result = results[*member];
+                    result.count += aggregate.count;
+                    result.sum += sum;
+                    result.min = std::min(result.min, aggregate.minValue);
+                    result.max = std::max(result.max, aggregate.maxValue);
+                }
+            }
+        }
+
+        for (auto &result : results)
+        {
+            if (result.count == 0 || !this->payload)
+            {
+                result.min = 0;
+                result.max = 0;
+            }
+        }
+        timer.stop();
+        return results;
+    }
+
+    void setAggregate(bool aggregate)
+    {
+        GLint aggregateLocation = glGetUniformLocation(this->shaderProgram, "aggregate");
+        glProgramUniform1i(this->shaderProgram, aggregateLocation, aggregate ? 1 : 0);
+    }
+};
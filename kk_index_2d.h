@@ -0,0 +1,357 @@
+#pragma once
+
+// KKIndex2D: answers conjunctive range predicates over two int32 key columns,
+// [x1, x2) x [y1, y2), with one draw per batch. Rows are placed on a grid
+// of framebuffer pixels by their two keys, and every query rectangle is
+// drawn as two triangles, so each covered cell becomes one fragment that
+// emits its rows into the result SSBO (shader2d.vs, shader2d.fs).
+//
+// A grid axis is one pixel per key while the key range fits the viewport.
+// Larger ranges are bucketed: a cell covers 2^shift consecutive keys, and
+// fragments of cells on the rectangle's border test every row against the
+// rectangle. The cells' posting lists are laid out as CSR, in row-major
+// order or, with zOrder, in Morton (Z) order, so that the rows of a
+// rectangle lie in fewer and longer runs of the row buffers.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "kk_index.h"
+#include "metrics.h"
+#include "query_decomposition.h"
+#include "query_results.h"
+
+// Half-open key rectangle [x1, x2) x [y1, y2)
+struct KeyRect
+{
+    int x1;
+    int x2;
+    int y1;
+    int y2;
+};
+
+// One corner of a query rectangle (RectVertex in shader2d.vs). rect holds
+// the query in keys relative to the grid minimum, as x1, x2, y1, y2.
+struct RectVertex
+{
+    float x;
+    float y;
+    int queryIndex;
+    GLuint rect[4];
+};
+
+// Spreads the low 16 bits of v over the even bits (as in shader2d.fs)
+inline uint32_t spreadBits(uint32_t v)
+{
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+class KKIndex2D
+{
+public:
+    GLuint shaderProgram = 0;
+    bool zOrder = false;   // Lay the cells out in Morton order
+    int maxGridWidth = 1024; // Viewport the grid must fit
+    int maxGridHeight = 1024;
+
+    // The grid: cell (cx, cy) holds the keys (minX + (cx << shiftX) ...,
+    // minY + (cy << shiftY) ...)
+    int minX = 0;
+    int minY = 0;
+    int shiftX = 0;
+    int shiftY = 0;
+    int gridWidth = 0;
+    int gridHeight = 0;
+    size_t numRows = 0;
+
+    std::vector<int> cellOffsets; // CSR offsets, one per cell index plus one
+    QueryResults results;          // Row identifiers of the last batch
+
+    bool compileShaders(const char *vertexShaderCode, const char *fragmentShaderCode)
+    {
+        StageTimer timer("shader_compile_time");
+        this->shaderProgram = compileShaderProgram(vertexShaderCode, fragmentShaderCode);
+        timer.stop("(2d)");
+        return this->shaderProgram != 0;
+    }
+
+    // Indexes row r under the key pair (xKeys[r], yKeys[r]).
+    bool build(const int *xKeys, const int *yKeys, size_t numRows)
+    {
+        StageTimer cpuTimer("grid_setup_time (cpu)");
+        release();
+        GLint maxTextureBufferSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferSize);
+        if (numRows == 0 || numRows > static_cast<size_t>(maxTextureBufferSize))
+        {
+            std::cerr << "Cannot index " << numRows << " rows in 2D (GL_MAX_TEXTURE_BUFFER_SIZE " << maxTextureBufferSize << ")." << std::endl;
+            return false;
+        }
+        this->numRows = numRows;
+        auto xRange = std::minmax_element(xKeys, xKeys + numRows);
+        auto yRange = std::minmax_element(yKeys, yKeys + numRows);
+        this->minX = *xRange.first;
+        this->minY = *yRange.first;
+        chooseAxis(static_cast<int64_t>(*xRange.second) - this->minX + 1, this->maxGridWidth, this->shiftX, this->gridWidth);
+        chooseAxis(static_cast<int64_t>(*yRange.second) - this->minY + 1, this->maxGridHeight, this->shiftY, this->gridHeight);
+        size_t numCells = cellIndex(this->gridWidth - 1, this->gridHeight - 1) + 1;
+        if (numCells + 1 > static_cast<size_t>(maxTextureBufferSize))
+        {
+            std::cerr << "A " << this->gridWidth << "x" << this->gridHeight << " grid does not fit GL_MAX_TEXTURE_BUFFER_SIZE." << std::endl;
+            return false;
+        }
+
+        // Counting sort of the rows by cell; rows of a cell stay ascending.
+        // Keys are stored relative to the minima, for the border tests.
+        std::vector<uint32_t> rowCells(numRows);
+        this->cellOffsets.assign(numCells + 1, 0);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            uint32_t x = static_cast<uint32_t>(xKeys[row]) - static_cast<uint32_t>(this->minX);
+            uint32_t y = static_cast<uint32_t>(yKeys[row]) - static_cast<uint32_t>(this->minY);
+            rowCells[row] = cellIndex(static_cast<int>(x >> this->shiftX), static_cast<int>(y >> this->shiftY));
+            this->cellOffsets[rowCells[row] + 1]++;
+        }
+        for (size_t cell = 0; cell < numCells; ++cell)
+        {
+            this->cellOffsets[cell + 1] += this->cellOffsets[cell];
+        }
+        std::vector<int> rowIds(numRows);
+        std::vector<int> rowKeys(2 * numRows);
+        std::vector<int> fill(this->cellOffsets.begin(), this->cellOffsets.end() - 1);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            int position = fill[rowCells[row]]++;
+            rowIds[position] = static_cast<int>(row);
+            rowKeys[2 * position] = static_cast<int>(static_cast<uint32_t>(xKeys[row]) - static_cast<uint32_t>(this->minX));
+            rowKeys[2 * position + 1] = static_cast<int>(static_cast<uint32_t>(yKeys[row]) - static_cast<uint32_t>(this->minY));
+        }
+        cpuTimer.stop("(" + std::to_string(this->gridWidth) + "x" + std::to_string(this->gridHeight) + " cells, shifts " +
+                      std::to_string(this->shiftX) + "/" + std::to_string(this->shiftY) + (this->zOrder ? ", z-order)" : ", row-major)"));
+
+        GpuStageTimer gpuTimer("grid_setup_time (gpu upload)");
+        this->cellOffsetsTexture = createIntTextureBuffer(this->cellOffsets.data(), this->cellOffsets.size(), &this->cellOffsetsBuffer);
+        this->rowIdsTexture = createIntTextureBuffer(rowIds.data(), rowIds.size(), &this->rowIdsBuffer);
+        this->rowKeysTexture = createIntTextureBuffer(rowKeys.data(), rowKeys.size(), &this->rowKeysBuffer, GL_STATIC_DRAW, GL_RG32I);
+        setUpFramebuffer();
+
+        glUseProgram(this->shaderProgram);
+        glUniform1i(glGetUniformLocation(this->shaderProgram, "cellOffsetsBuffer"), 0);
+        glUniform1i(glGetUniformLocation(this->shaderProgram, "rowIdsBuffer"), 1);
+        glUniform1i(glGetUniformLocation(this->shaderProgram, "rowKeysBuffer"), 2);
+        glUniform2i(glGetUniformLocation(this->shaderProgram, "gridSize"), this->gridWidth, this->gridHeight);
+        glUniform2ui(glGetUniformLocation(this->shaderProgram, "cellShift"), this->shiftX, this->shiftY);
+        glUniform1i(glGetUniformLocation(this->shaderProgram, "zOrder"), this->zOrder ? 1 : 0);
+        glm::mat4 projectionMatrix = glm::ortho(0.0f, static_cast<float>(this->gridWidth), 0.0f, static_cast<float>(this->gridHeight), -1.0f, 1.0f);
+        glUniformMatrix4fv(glGetUniformLocation(this->shaderProgram, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+
+        glGenBuffers(1, &this->dataSSBO);
+        glGenBuffers(1, &this->atomicCounterBuffer);
+        GLuint zero = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, this->atomicCounterBuffer);
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
+        glGenVertexArrays(1, &this->rectVAO);
+        glGenBuffers(1, &this->rectVBO);
+        glBindVertexArray(this->rectVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->rectVBO);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(RectVertex), (void *)offsetof(RectVertex, x));
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(1, 1, GL_INT, sizeof(RectVertex), (void *)offsetof(RectVertex, queryIndex));
+        glEnableVertexAttribArray(1);
+        glVertexAttribIPointer(2, 4, GL_UNSIGNED_INT, sizeof(RectVertex), (void *)offsetof(RectVertex, rect));
+        glEnableVertexAttribArray(2);
+        gpuTimer.stop();
+        return true;
+    }
+
+    // Runs one batch of rectangles and returns the row identifiers of each,
+    // in ascending order. The returned results are reused by the next batch.
+    const QueryResults &queryRows(const std::vector<KeyRect> &rects)
+    {
+        GpuStageTimer timer("query_time");
+        int vertices = createRectangles(rects);
+
+        glUseProgram(this->shaderProgram);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glViewport(0, 0, this->gridWidth, this->gridHeight);
+        glBindVertexArray(this->rectVAO);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, this->cellOffsetsTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, this->rowIdsTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, this->rowKeysTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, this->atomicCounterBuffer);
+        GLint countOnlyLocation = glGetUniformLocation(this->shaderProgram, "countOnly");
+
+        // Counting pass, exact allocation, then the materializing pass
+        glUniform1i(countOnlyLocation, 1);
+        GLuint totalEntries = drawRectangles(vertices);
+        if (totalEntries > this->ssboCapacity)
+        {
+            this->ssboCapacity = totalEntries;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->dataSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(totalEntries, 1) * sizeof(ResultData), nullptr, GL_DYNAMIC_COPY);
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->dataSSBO);
+        glUniform1i(countOnlyLocation, 0);
+        totalEntries = drawRectangles(vertices);
+        timer.stop();
+
+        StageTimer assemblyTimer("result_assembly_time");
+        std::vector<std::pair<int, int>> identity(rects.size());
+        QueryDecomposition decomposition = directSubqueries(identity);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->dataSSBO);
+        const ResultData *entries = totalEntries ? (const ResultData *)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY) : nullptr;
+        if (totalEntries && !entries)
+        {
+            std::cerr << "Failed to map SSBO for reading." << std::endl;
+            totalEntries = 0;
+        }
+        assembleQueryResults(entries, std::min<size_t>(totalEntries, this->ssboCapacity), decomposition, rects.size(), this->results);
+        if (entries)
+        {
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        }
+        assemblyTimer.stop();
+        return this->results;
+    }
+
+private:
+    GLuint cellOffsetsBuffer = 0;
+    GLuint cellOffsetsTexture = 0;
+    GLuint rowIdsBuffer = 0;
+    GLuint rowIdsTexture = 0;
+    GLuint rowKeysBuffer = 0; // (x, y) keys of every rowIds entry, relative to the minima
+    GLuint rowKeysTexture = 0;
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint rectVAO = 0;
+    GLuint rectVBO = 0;
+    size_t rectCapacity = 0; // RectVertices rectVBO holds
+    GLuint dataSSBO = 0;
+    GLuint atomicCounterBuffer = 0;
+    GLuint ssboCapacity = 0;
+
+    // One pixel per key while the range fits, else 2^shift keys per cell
+    static void chooseAxis(int64_t range, int maxCells, int &shift, int &cells)
+    {
+        shift = 0;
+        while ((range + (int64_t(1) << shift) - 1) >> shift > maxCells)
+        {
+            ++shift;
+        }
+        cells = static_cast<int>((range + (int64_t(1) << shift) - 1) >> shift);
+    }
+
+    uint32_t cellIndex(int cx, int cy) const
+    {
+        if (this->zOrder)
+        {
+            return spreadBits(cx) | (spreadBits(cy) << 1);
+        }
+        return static_cast<uint32_t>(cy) * this->gridWidth + cx;
+    }
+
+    // Writes two triangles per non-empty rectangle, covering its cells
+    int createRectangles(const std::vector<KeyRect> &rects)
+    {
+        StageTimer timer("rectangle_creation_time");
+        std::vector<RectVertex> vertices;
+        vertices.reserve(6 * rects.size());
+        for (size_t q = 0; q < rects.size(); ++q)
+        {
+            // Relative to the minima and clamped to the grid
+            const KeyRect &rect = rects[q];
+            int64_t xEnd = static_cast<int64_t>(this->gridWidth) << this->shiftX;
+            int64_t yEnd = static_cast<int64_t>(this->gridHeight) << this->shiftY;
+            int64_t x1 = std::min(std::max<int64_t>(static_cast<int64_t>(rect.x1) - this->minX, 0), xEnd);
+            int64_t x2 = std::min(std::max<int64_t>(static_cast<int64_t>(rect.x2) - this->minX, 0), xEnd);
+            int64_t y1 = std::min(std::max<int64_t>(static_cast<int64_t>(rect.y1) - this->minY, 0), yEnd);
+            int64_t y2 = std::min(std::max<int64_t>(static_cast<int64_t>(rect.y2) - this->minY, 0), yEnd);
+            if (x1 >= x2 || y1 >= y2)
+            {
+                continue;
+            }
+            float left = static_cast<float>(x1 >> this->shiftX);
+            float right = static_cast<float>(((x2 - 1) >> this->shiftX) + 1);
+            float bottom = static_cast<float>(y1 >> this->shiftY);
+            float top = static_cast<float>(((y2 - 1) >> this->shiftY) + 1);
+            // Past the last key is clamped to the largest relative key
+            GLuint bounds[4] = {static_cast<GLuint>(x1), static_cast<GLuint>(std::min<int64_t>(x2, UINT32_MAX)), static_cast<GLuint>(y1),
+                                static_cast<GLuint>(std::min<int64_t>(y2, UINT32_MAX))};
+            const float corners[6][2] = {{left, bottom}, {right, bottom}, {right, top}, {left, bottom}, {right, top}, {left, top}};
+            for (const auto &corner : corners)
+            {
+                vertices.push_back(RectVertex{corner[0], corner[1], static_cast<int>(q), {bounds[0], bounds[1], bounds[2], bounds[3]}});
+            }
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->rectVBO);
+        if (vertices.size() > this->rectCapacity)
+        {
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(RectVertex), vertices.data(), GL_DYNAMIC_DRAW);
+            this->rectCapacity = vertices.size();
+        }
+        else if (!vertices.empty())
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(RectVertex), vertices.data());
+        }
+        timer.stop("(" + std::to_string(vertices.size() / 6) + " rectangles)");
+        return static_cast<int>(vertices.size());
+    }
+
+    // Draws the rectangles and returns the counter
+    GLuint drawRectangles(int vertices)
+    {
+        GLuint zero = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, this->atomicCounterBuffer);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+        if (vertices > 0)
+        {
+            glDrawArrays(GL_TRIANGLES, 0, vertices);
+        }
+        glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        GLuint value = 0;
+        glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &value);
+        return value;
+    }
+
+    void setUpFramebuffer()
+    {
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glGenTextures(1, &this->colorTexture);
+        glBindTexture(GL_TEXTURE_2D, this->colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->gridWidth, this->gridHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorTexture, 0);
+    }
+
+    void release()
+    {
+        GLuint textures[] = {this->cellOffsetsTexture, this->rowIdsTexture, this->rowKeysTexture, this->colorTexture};
+        GLuint buffers[] = {this->cellOffsetsBuffer, this->rowIdsBuffer, this->rowKeysBuffer, this->rectVBO, this->dataSSBO, this->atomicCounterBuffer};
+        if (this->framebuffer)
+        {
+            glDeleteTextures(4, textures);
+            glDeleteBuffers(6, buffers);
+            glDeleteFramebuffers(1, &this->framebuffer);
+            glDeleteVertexArrays(1, &this->rectVAO);
+        }
+        this->cellOffsetsTexture = this->rowIdsTexture = this->rowKeysTexture = this->colorTexture = 0;
+        this->cellOffsetsBuffer = this->rowIdsBuffer = this->rowKeysBuffer = this->rectVBO = 0;
+        this->dataSSBO = this->atomicCounterBuffer = this->framebuffer = this->rectVAO = 0;
+        this->rectCapacity = 0;
+        this->ssboCapacity = 0;
+    }
+};
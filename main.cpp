@@ -1,873 +1,640 @@
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
-#include <cstdlib>   // For std::atoi
+#include <cerrno>
+#include <climits>
+#include <cstdlib>   // For std::atoi and std::strtol
 #include <chrono>    // For high-resolution timing
-#include <algorithm> // For std::min and std::max
 #include <set>
-#include <cassert>
-
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/type_ptr.hpp>
-
-struct Vertex
+#include <memory>
+
+#include "btree_index.h"
+#include "column_table.h"
+#include "cpu_index.h"
+#include "gl_context.h"
+#include "index_backend.h"
+#include "kk_index.h"
+#include "kk_index_2d.h"
+#include "metrics.h"
+#include "query_pipeline.h"
+#include "query_results.h"
+#include "query_server.h"
+#include "table_loader.h"
+#include "table_source.h"
+
+// Convert a CSV table into a .kkcol file holding the given columns (the first
+// one becomes the key column).
+bool convertTable(const char *tableFile, const char *outputFile, const std::vector<int> &columnIndices)
 {
-    int indexValue;    // First column (index)
-    int rowIdentifier; // Row identifier (sequential)
-};
-
-#include <map>
-#include <set>
-
-struct Subquery {
-    int start;
-    int end;
-    int queryIndex; // Unique index for subquery
-    std::set<int> originalQueries; // Indices of original queries this subquery belongs to
-};
-
-std::vector<Subquery> decomposeQueries(const std::vector<std::pair<int, int>>& queries) {
-    // Collect all query endpoints
-    std::vector<int> endpoints;
-    for (const auto& query : queries) {
-        endpoints.push_back(query.first);
-        endpoints.push_back(query.second);
-    }
-
-    // Remove duplicates and sort
-    std::sort(endpoints.begin(), endpoints.end());
-    endpoints.erase(std::unique(endpoints.begin(), endpoints.end()), endpoints.end());
-
-    // Create subqueries between each pair of endpoints
-    std::vector<Subquery> subqueries;
-    int subqueryIndex = 0;
-    for (size_t i = 0; i < endpoints.size() - 1; ++i) {
-        int start = endpoints[i];
-        int end = endpoints[i + 1];
-
-        // Find which original queries this subquery belongs to
-        std::set<int> originalQueriesIndices;
-        for (size_t q = 0; q < queries.size(); ++q) {
-            if (queries[q].first < end && queries[q].second > start) {
-                originalQueriesIndices.insert(q);
-            }
-        }
-        
-        // Only include subqueries that cover a range
-        if (originalQueriesIndices.size() == 0) {
-            continue;
-        }
-
-        Subquery subquery;
-        subquery.start = start;
-        subquery.end = end;
-        subquery.queryIndex = subqueryIndex++;
-        subquery.originalQueries = originalQueriesIndices;
-        subqueries.push_back(subquery);
+    StageTimer timer("convert_time");
+    ColumnTable table = loadTableParallel(tableFile, columnIndices);
+    size_t numRows = table.numRows;
+    if (numRows == 0)
+    {
+        std::cerr << "No rows loaded from " << tableFile << std::endl;
+        return false;
+    }
 
-        
+    std::vector<const int *> columnPointers;
+    for (const auto &column : table.columns)
+    {
+        columnPointers.push_back(column.data());
     }
+    bool ok = writeColumnTable(outputFile, columnIndices, columnPointers, numRows);
 
-    return subqueries;
+    std::cout << "rows: " << numRows << ", columns: " << table.columns.size() << std::endl;
+    timer.stop();
+    return ok;
 }
 
-void checkGLError(const char *functionName)
+// Ordered output: rows must come by ascending key, and by ascending row
+// identifier within a key.
+bool checkKeyOrder(const int *keys, RowSpan rows)
 {
-    GLenum error;
-    while ((error = glGetError()) != GL_NO_ERROR)
+    for (size_t i = 1; i < rows.size(); ++i)
     {
-        std::cerr << "OpenGL Error after " << functionName << ": ";
-        switch (error)
+        int previous = rows.data()[i - 1];
+        int row = rows.data()[i];
+        if (keys[previous] > keys[row] || (keys[previous] == keys[row] && previous >= row))
         {
-        case GL_INVALID_ENUM:
-            std::cerr << "GL_INVALID_ENUM\n";
-            break;
-        case GL_INVALID_VALUE:
-            std::cerr << "GL_INVALID_VALUE\n";
-            break;
-        case GL_INVALID_OPERATION:
-            std::cerr << "GL_INVALID_OPERATION\n";
-            break;
-        case GL_STACK_OVERFLOW:
-            std::cerr << "GL_STACK_OVERFLOW\n";
-            break;
-        case GL_STACK_UNDERFLOW:
-            std::cerr << "GL_STACK_UNDERFLOW\n";
-            break;
-        case GL_OUT_OF_MEMORY:
-            std::cerr << "GL_OUT_OF_MEMORY\n";
-            break;
-        case GL_INVALID_FRAMEBUFFER_OPERATION:
-            std::cerr << "GL_INVALID_FRAMEBUFFER_OPERATION\n";
-            break;
-        default:
-            std::cerr << "Unknown error\n";
-            break;
+            std::cerr << "Rows out of key order at " << i << ": " << previous << ", " << row << std::endl;
+            return false;
         }
     }
+    return true;
 }
 
-// Function to load CSV data and create vertices
-std::vector<Vertex> loadTable(const char *filename)
+// Parses an integer argument; the whole token must be an int.
+bool parseIntArgument(const char *token, int &value)
 {
-    std::vector<Vertex> vertices;
-    std::ifstream file(filename);
-    if (!file.is_open())
+    char *end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(token, &end, 10);
+    if (end == token || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
     {
-        std::cerr << "Failed to open file: " << filename << std::endl;
-        return vertices;
+        return false;
     }
+    value = static_cast<int>(parsed);
+    return true;
+}
 
-    std::string line;
-    int row = 0;
-    while (std::getline(file, line))
+// Recomputes the rows of [query_x1, query_x2) by a scan of the key column
+// and compares them with uniqueValues. query_x2 is 64-bit so that a lookup
+// of INT_MAX can be checked as [INT_MAX, INT_MAX + 1).
+void check(const int *keys, size_t numRows, const std::set<int> &uniqueValues, int query_x1, long long query_x2)
+{
+    StageTimer timer("check_time");
+    std::set<int> correctValues;
+    for (size_t row = 0; row < numRows; ++row)
     {
-        std::stringstream ss(line);
-        std::string cell;
-
-        if (std::getline(ss, cell, '|'))
+        if (keys[row] >= query_x1 && keys[row] < query_x2)
+        {
+            correctValues.insert(static_cast<int>(row));
+        }
+    }
+    std::cout << "correct values: " << correctValues.size() << std::endl;
+    if (correctValues == uniqueValues)
+    {
+        std::cout << "All values are correct!" << std::endl;
+    }
+    else
+    {
+        std::cerr << "Some values are incorrect!" << std::endl;
+
+        // print the query results.
+        // std::cout << "Unique values in SSBO:" << std::endl;
+        // for (const int& val : uniqueValues) {
+        //     std::cout << vertices[val].indexValue<< std::endl;
+        // }
+        // Find the incorrect values
+        std::set<int> incorrectValues;
+        std::set_difference(correctValues.begin(), correctValues.end(), uniqueValues.begin(), uniqueValues.end(), std::inserter(incorrectValues, incorrectValues.begin()));
+        std::set_difference(uniqueValues.begin(), uniqueValues.end(), correctValues.begin(), correctValues.end(), std::inserter(incorrectValues, incorrectValues.begin()));
+        for (const int &value : incorrectValues)
         {
-            Vertex vertex;
-            vertex.indexValue = std::stoi(cell);
-            vertex.rowIdentifier = row; // Assign row identifier sequentially
-            vertices.push_back(vertex);
+            std::cerr << "Incorrect value: " << value;
+            if (correctValues.find(value) != correctValues.end())
+            {
+                std::cerr << ", Value is present in correct values i.e not in result." << std::endl;
+            }
+            else
+            {
+                std::cerr << ", Value is not present in correct values i.e in result." << std::endl;
+            }
         }
-        row++;
+        std::cout << "Number of incorrect values: " << incorrectValues.size() << std::endl;
     }
-    file.close();
-    return vertices;
+    timer.stop();
 }
 
-// Function to load shader code from a file
-std::string loadShaderCode(const char *filePath)
+// Recomputes the aggregates of [query_x1, query_x2) on the CPU and
+// compares them with result.
+void checkAggregate(const int *keys, const int *payload, size_t numRows, const AggregateResult &result, int query_x1, int query_x2)
 {
-    std::ifstream shaderFile(filePath);
-    if (!shaderFile.is_open())
+    AggregateResult expected{0, 0, 0, 0};
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        if (keys[row] >= query_x1 && keys[row] < query_x2)
+        {
+            int value = payload ? payload[row] : 0;
+            expected.min = expected.count == 0 ? value : std::min(expected.min, value);
+            expected.max = expected.count == 0 ? value : std::max(expected.max, value);
+            expected.sum += value;
+            expected.count++;
+        }
+    }
+    std::cout << "count: " << result.count << ", sum: " << result.sum << ", min: " << result.min << ", max: " << result.max << std::endl;
+    if (expected.count == result.count && expected.sum == result.sum && expected.min == result.min && expected.max == result.max)
+    {
+        std::cout << "All values are correct!" << std::endl;
+    }
+    else
     {
-        std::cerr << "Failed to open shader file: " << filePath << std::endl;
-        return "";
+        std::cerr << "Aggregates are incorrect! expected count: " << expected.count << ", sum: " << expected.sum
+                  << ", min: " << expected.min << ", max: " << expected.max << std::endl;
     }
-    std::stringstream shaderStream;
-    shaderStream << shaderFile.rdbuf();
-    return shaderStream.str();
 }
 
-// Utility function to compile shader program with error checking
-GLuint compileShaderProgram(const char *vertexSource, const char *fragmentSource)
+// Recomputes the rows of a rectangle by a scan of both key columns and
+// compares them with rows.
+void checkRectangle(const int *xKeys, const int *yKeys, size_t numRows, RowSpan rows, const KeyRect &rect)
 {
-    // Create shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Set shader sources
-    glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-    glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-
-    GLint success;
-    GLchar infoLog[512];
-
-    // Compile vertex shader
-    glCompileShader(vertexShader);
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    StageTimer timer("check_time");
+    std::vector<int> correctRows;
+    for (size_t row = 0; row < numRows; ++row)
     {
-        glGetShaderInfoLog(vertexShader, 512, nullptr, infoLog);
-        std::cerr << "Error compiling vertex shader:\n"
-                  << infoLog << std::endl;
-        return 0;
+        if (xKeys[row] >= rect.x1 && xKeys[row] < rect.x2 && yKeys[row] >= rect.y1 && yKeys[row] < rect.y2)
+        {
+            correctRows.push_back(static_cast<int>(row));
+        }
     }
-
-    // Compile fragment shader
-    glCompileShader(fragmentShader);
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    std::cout << "correct values: " << correctRows.size() << std::endl;
+    if (std::equal(correctRows.begin(), correctRows.end(), rows.begin(), rows.end()))
     {
-        glGetShaderInfoLog(fragmentShader, 512, nullptr, infoLog);
-        std::cerr << "Error compiling fragment shader:\n"
-                  << infoLog << std::endl;
-        return 0;
+        std::cout << "All values are correct!" << std::endl;
     }
-
-    // Link shaders into a program
-    GLuint programID = glCreateProgram();
-    glAttachShader(programID, vertexShader);
-    glAttachShader(programID, fragmentShader);
-    glLinkProgram(programID);
-
-    // Check for linking errors
-    glGetProgramiv(programID, GL_LINK_STATUS, &success);
-    if (!success)
+    else
     {
-        glGetProgramInfoLog(programID, 512, nullptr, infoLog);
-        std::cerr << "Error linking shader program:\n"
-                  << infoLog << std::endl;
-        return 0;
+        std::cerr << "Some values are incorrect! " << rows.size() << " rows instead of " << correctRows.size() << std::endl;
     }
-
-    // Clean up shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return programID;
+    timer.stop();
 }
 
-void APIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
-                              GLsizei length, const GLchar *message, const void *userParam)
+// Checks the pairs of a join: every pair must join equal keys, no pair may
+// repeat, and there must be as many pairs as matches counted over the sorted
+// inner keys.
+void checkJoin(const int *outerKeys, size_t numOuterRows, const int *innerKeys, size_t numInnerRows, std::vector<JoinPair> pairs)
 {
-    std::cerr << "GL CALLBACK: " << message << std::endl;
-}
+    StageTimer timer("check_time");
+    std::vector<int> sortedInnerKeys(innerKeys, innerKeys + numInnerRows);
+    std::sort(sortedInnerKeys.begin(), sortedInnerKeys.end());
+    size_t expectedPairs = 0;
+    for (size_t row = 0; row < numOuterRows; ++row)
+    {
+        auto matches = std::equal_range(sortedInnerKeys.begin(), sortedInnerKeys.end(), outerKeys[row]);
+        expectedPairs += matches.second - matches.first;
+    }
 
-struct ResultData
-{
-    int queryIndex;
-    int rowIdentifier;
-};
+    size_t wrongKeys = 0;
+    for (const JoinPair &pair : pairs)
+    {
+        if (outerKeys[pair.outerRow] != innerKeys[pair.innerRow])
+        {
+            ++wrongKeys;
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const JoinPair &a, const JoinPair &b) {
+        return a.outerRow != b.outerRow ? a.outerRow < b.outerRow : a.innerRow < b.innerRow;
+    });
+    auto repeated = std::adjacent_find(pairs.begin(), pairs.end(), [](const JoinPair &a, const JoinPair &b) {
+        return a.outerRow == b.outerRow && a.innerRow == b.innerRow;
+    });
+
+    std::cout << "correct pairs: " << expectedPairs << std::endl;
+    if (wrongKeys == 0 && repeated == pairs.end() && pairs.size() == expectedPairs)
+    {
+        std::cout << "All join pairs are correct!" << std::endl;
+    }
+    else
+    {
+        std::cerr << "Join is incorrect: " << pairs.size() << " pairs, " << wrongKeys << " with unequal keys, "
+                  << (repeated == pairs.end() ? "none" : "some") << " repeated" << std::endl;
+    }
+    timer.stop();
+}
 
-class KKIndex
+// --2d: answers the rectangles [x1, x2) x [y1, y2) of queryBounds (four
+// values each) on column 0 and yColumn with KKIndex2D, and checks them.
+int runRectangleQueries(const char *tableFile, int yColumn, bool zOrder, int gridWidth, int gridHeight, const std::vector<int> &queryBounds)
 {
-public:
-    GLuint shaderProgram;
-    std::vector<Vertex> vertices;
-    std::vector<int> textureData;
-    int viewPortWidth;
-    int viewPortHeight;
-    GLuint atomicCounterBuffer;
-    GLuint dataSSBO;
-    std::vector<Subquery> lastSubqueries;
-
-    void loadTableData(const char *filename)
+    if (queryBounds.empty() || queryBounds.size() % 4 != 0)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        this->vertices = loadTable(filename);
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "table_load_time: " << elapsed.count() << " ms" << std::endl;
+        std::cerr << "Error: Each rectangle needs x1 x2 y1 y2." << std::endl;
+        return -1;
     }
-
-    void compileShaders(const char *vertexShaderCode, const char *fragmentShaderCode)
+    // The second key column is loaded the way a payload column is
+    TableSource table;
+    if (!table.load(tableFile, yColumn) || !table.payload)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        this->shaderProgram = compileShaderProgram(vertexShaderCode, fragmentShaderCode);
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+        return -1;
+    }
 
-        glUseProgram(this->shaderProgram);
-        std::cout << "shader_compile_time: " << elapsed.count() << " ms" << std::endl;
+    KKIndex2D index;
+    index.zOrder = zOrder;
+    index.maxGridWidth = gridWidth;
+    index.maxGridHeight = gridHeight;
+    if (!index.compileShaders(loadShaderCode("shader2d.vs").c_str(), loadShaderCode("shader2d.fs").c_str()) ||
+        !index.build(table.keys, table.payload, table.numRows))
+    {
+        return -1;
     }
 
-    void setUpTexture()
+    std::vector<KeyRect> rects;
+    for (size_t i = 0; i < queryBounds.size(); i += 4)
+    {
+        rects.push_back(KeyRect{queryBounds[i], queryBounds[i + 1], queryBounds[i + 2], queryBounds[i + 3]});
+    }
+    const QueryResults &results = index.queryRows(rects);
+    for (size_t i = 0; i < rects.size(); ++i)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        int range_min = this->vertices[0].indexValue;
-        int range_max = this->vertices[0].indexValue;
+        checkRectangle(table.keys, table.payload, table.numRows, results[i], rects[i]);
+    }
+    std::cout << "total (index) entries: " << results.totalRows() << std::endl;
+    return 0;
+}
 
-        for (const auto &vertex : this->vertices)
+// TOOD: think what to do when range_min is not 0.
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && std::string(argv[1]) == "--convert")
+    {
+        if (argc < 4)
         {
-            range_min = std::min(range_min, vertex.indexValue);
-            range_max = std::max(range_max, vertex.indexValue);
+            std::cerr << "Usage: " << argv[0] << " --convert <table_file> <output.kkcol> [column ...]" << std::endl;
+            return -1;
         }
-        // so that range_min and range_max are not out of the bounds.
-        range_min -= 1;
-        range_max += 1;
-
-        std::cout << "Range: [" << range_min << ", " << range_max << "]" << std::endl;
-        int textureSize = range_max - range_min + 1;
-
-        // Create textureData vector initialized to -1
-        this->textureData.resize(textureSize, -1);
-        for (const auto &vertex : this->vertices)
+        // The first listed column is the key column; defaults to column 0.
+        std::vector<int> columnIndices;
+        for (int i = 4; i < argc; ++i)
         {
-            int index = vertex.indexValue;
-            this->textureData[index] = vertex.rowIdentifier;
+            columnIndices.push_back(std::atoi(argv[i]));
         }
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "texture_setup_time (cpu): " << elapsed.count() << " ms" << std::endl;
-        // Create and bind a 1D texture as TBO.
-        // Generate and bind a buffer object for the texture buffer
-
-        GLuint tbo;
-        glGenBuffers(1, &tbo);
-        glBindBuffer(GL_TEXTURE_BUFFER, tbo);
-
-        // Upload your data to the buffer
-        glBufferData(GL_TEXTURE_BUFFER, textureSize * sizeof(int), this->textureData.data(), GL_STATIC_DRAW);
-
-        // Generate the texture buffer object
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_BUFFER, textureID);
-
-        // Associate the buffer with the texture buffer
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, tbo);
-
-        // Set uniform variables
-        GLint rangeMinLocation = glGetUniformLocation(this->shaderProgram, "range_min");
-        glUniform1f(rangeMinLocation, static_cast<float>(range_min));
-
-        GLint rangeMaxLocation = glGetUniformLocation(this->shaderProgram, "range_max");
-        glUniform1f(rangeMaxLocation, static_cast<float>(range_max));
-
-        GLint textureSizeLocation = glGetUniformLocation(this->shaderProgram, "textureSize");
-        glUniform1i(textureSizeLocation, textureSize);
-
-        // Bind the texture buffer to texture unit 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_BUFFER, textureID);
-
-        // Set the sampler uniform in your shader to use texture unit 0
-        GLuint dataTextureBufferLocation = glGetUniformLocation(shaderProgram, "dataTextureBuffer");
-        glUniform1i(dataTextureBufferLocation, 0);
-
-        std::chrono::high_resolution_clock::time_point endTime2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed2 = endTime2 - endTime;
-
-        std::cout << "texture size in elements: " << textureSize << std::endl;
-        std::cout << "texture size in bytes: " << textureSize * sizeof(int) << std::endl;
-        std::cout << "texture_setup_time (gpu upload + binding): " << elapsed2.count() << " ms" << std::endl;
-    }
-
-    void setuptFrameBuffersAndViewPort(int width, int height, bool useFBO)
-    {
-        this->viewPortWidth = width;
-        this->viewPortHeight = height;
-
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-
-        // Set viewport
-        glViewport(0, 0, width, height);
-        checkGLError("glViewport");
-        // Pass the projection matrix to your shader
-        glm::mat4 projectionMatrix = glm::ortho(
-            static_cast<float>(0),
-            static_cast<float>(width),
-            static_cast<float>(0),
-            static_cast<float>(height),
-            -1.0f, 1.0f // Near and Far planes
-        );
-
-        GLint projMatrixLocation = glGetUniformLocation(this->shaderProgram, "projectionMatrix");
-        glUniformMatrix4fv(projMatrixLocation, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-        GLint viewportWidthLocation = glGetUniformLocation(shaderProgram, "viewportWidth");
-        glUniform1i(viewportWidthLocation, width);
-
-        // Optionally set FBO.
-        if (useFBO)
+        if (columnIndices.empty())
         {
-            unsigned int framebuffer;
-            glGenFramebuffers(1, &framebuffer);
-            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-
-            unsigned int colorTexture;
-            glGenTextures(1, &colorTexture);
-            glBindTexture(GL_TEXTURE_2D, colorTexture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+            columnIndices.push_back(0);
         }
-        GLint invertYLocation = glGetUniformLocation(this->shaderProgram, "screen");
-        glUniform1i(invertYLocation, useFBO ? 0 : 1);
-
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "framebuffer_setup_time: " << elapsed.count() << " ms" << std::endl;
+        return convertTable(argv[2], argv[3], columnIndices) ? 0 : -1;
     }
 
-    int createLinesForQueries(const std::vector<Subquery> &queries)
-    {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        struct LineVertex
-        {
-            float x;
-            float y;
-            int queryIndex;
-        };
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <table_file|table.kkcol> <query_x1 query_x2 ...|--lookup key ...> [--non-overlapping] [--aggregate [--payload <column>]] [--backend kk|cpu|btree|all] [--engine raster|compute] [--rank] [--no-subgroups] [--viewport <width> <height>] [--retry-overflow|--ordered] [--snapshot <file.kkidx>] [--window] [--debug] [--metrics <file.jsonl>|--trace <file.json>]" << std::endl;
+        std::cerr << "       " << argv[0] << " <table_file|table.kkcol> --serve <-|query_file|unix:socket_path> [--binary] [--pipeline <depth>] [--non-overlapping] [--aggregate [--payload <column>]] [--backend kk|cpu|btree] [--engine raster|compute] [--rank] [--no-subgroups] [--viewport <width> <height>] [--retry-overflow|--ordered] [--snapshot <file.kkidx>] [--window] [--metrics <file.jsonl>|--trace <file.json>]" << std::endl;
+        std::cerr << "       " << argv[0] << " <inner_table> --join <outer_table> [--backend kk|cpu|btree] [--rank] [--viewport <width> <height>]" << std::endl;
+        std::cerr << "       " << argv[0] << " <table_file|table.kkcol> --2d <y_column> <x1 x2 y1 y2 ...> [--z-order] [--viewport <width> <height>] [--window]" << std::endl;
+        std::cerr << "       " << argv[0] << " --convert <table_file> <output.kkcol> [column ...]" << std::endl;
+        return -1;
+    }
 
-        std::vector<LineVertex> lineVertices;
-        int queryCount = 0;
+    const char *tableFile = argv[1];
 
-        for (const auto &query : queries)
-        {
-            int query_x1 = query.start;
-            int query_x2 = query.end;
-            int queryIndex = query.queryIndex;
-
-            // Modify the query_x1 and query_x2 so that point lookup can happen.
-            assert(query_x1 <= query_x2);
-            auto query_range = query_x2 - query_x1;
-            if (query_range < 0.0)
-            {
-                std::cerr << "query_x2 should be greater than query_x1" << std::endl;
+    // Separate the flags from the query bounds
+    bool queriesAreNonOverlapping = false;
+    bool useWindow = false;
+    bool binaryFraming = false;
+    bool debug = false;
+    bool useSubgroups = true;
+    bool rankCompressed = false;
+    bool aggregate = false;
+    bool lookup = false;
+    std::string joinTable;
+    int payloadColumn = -1;
+    ResultAllocation resultAllocation = ResultAllocation::CountFirst;
+    QueryEngine engine = QueryEngine::Raster;
+    std::string backendName = "kk";
+    int windowWidth = 600;
+    int windowHeight = 400;
+    std::string serveSource;
+    std::string snapshotFile;
+    int rectangleColumn = -1;
+    bool zOrder = false;
+    int pipelineDepth = 0;
+    std::vector<int> queryBounds;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--non-overlapping") {
+            queriesAreNonOverlapping = true;
+        } else if (arg == "--window") {
+            useWindow = true;
+        } else if (arg == "--viewport" && i + 2 < argc) {
+            if (!parseIntArgument(argv[i + 1], windowWidth) || !parseIntArgument(argv[i + 2], windowHeight) ||
+                windowWidth <= 0 || windowHeight <= 0 || static_cast<long long>(windowWidth) * windowHeight > INT_MAX) {
+                std::cerr << "Invalid viewport " << argv[i + 1] << " " << argv[i + 2] << std::endl;
+                return -1;
+            }
+            i += 2;
+        } else if (arg == "--retry-overflow") {
+            resultAllocation = ResultAllocation::Retry;
+        } else if (arg == "--ordered") {
+            resultAllocation = ResultAllocation::Ordered;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "compute") {
+                engine = QueryEngine::Compute;
+            } else if (name == "cpu") {
+                backendName = "cpu"; // Same as --backend cpu
+            } else if (name != "raster") {
+                std::cerr << "Unknown engine: " << name << std::endl;
+                return -1;
+            }
+        } else if (arg == "--backend" && i + 1 < argc) {
+            backendName = argv[++i];
+        } else if (arg == "--rank") {
+            rankCompressed = true;
+        } else if (arg == "--no-subgroups") {
+            useSubgroups = false;
+        } else if (arg == "--debug") {
+            debug = true;
+        } else if (arg == "--binary") {
+            binaryFraming = true;
+        } else if (arg == "--join" && i + 1 < argc) {
+            joinTable = argv[++i];
+        } else if (arg == "--lookup") {
+            lookup = true;
+        } else if (arg == "--aggregate") {
+            aggregate = true;
+        } else if (arg == "--payload" && i + 1 < argc) {
+            payloadColumn = std::atoi(argv[++i]);
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            // Stage timings as JSON lines
+            if (!metricsSink().open(argv[++i], MetricsSink::Format::JsonLines)) {
+                return -1;
+            }
+        } else if (arg == "--trace" && i + 1 < argc) {
+            // Stage timings as a Chrome trace
+            if (!metricsSink().open(argv[++i], MetricsSink::Format::ChromeTrace)) {
                 return -1;
             }
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            pipelineDepth = std::atoi(argv[++i]);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveSource = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotFile = argv[++i];
+        } else if (arg == "--2d" && i + 1 < argc) {
+            rectangleColumn = std::atoi(argv[++i]);
+        } else if (arg == "--z-order") {
+            zOrder = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            // A misspelt flag, or a flag whose value is missing
+            std::cerr << "Unknown option: " << arg << (i + 1 == argc ? " (or missing value)" : "") << std::endl;
+            return -1;
+        } else {
+            int bound;
+            if (!parseIntArgument(argv[i], bound)) {
+                std::cerr << "Not a query bound: " << arg << std::endl;
+                return -1;
+            }
+            queryBounds.push_back(bound);
+        }
+    }
+
+    if (lookup && queryBounds.empty()) {
+        std::cerr << "Error: --lookup needs at least one key." << std::endl;
+        return -1;
+    }
+    if (serveSource.empty() && rectangleColumn < 0 && !lookup && joinTable.empty() && (queryBounds.empty() || queryBounds.size() % 2 != 0)) {
+        std::cerr << "Error: Each query should have a start and end value." << std::endl;
+        return -1;
+    }
 
-            // Calculate starting and ending points
-            int start_y = static_cast<int>(query_x1 / this->viewPortWidth) + 1;
-            int start_x = static_cast<int>(query_x1 - (start_y - 1) * this->viewPortWidth);
-            int end_y = static_cast<int>(query_x2 / this->viewPortWidth) + 1;
-            int end_x = static_cast<int>(query_x2 - (end_y - 1) * this->viewPortWidth);
+    // Responses may go to stdout while serving, so keep the log on stderr.
+    if (!serveSource.empty()) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
 
-            // Iterate from start_y to end_y to create lines
-            for (int y = start_y; y <= end_y; ++y)
+    // Every backend indexes the same loaded columns
+    TableSource table;
+    GLContext context;
+    KKIndex kkIndex;
+    CpuIndex cpuIndex;
+    BTreeIndex btreeIndex;
+    bool compareAll = backendName == "all";
+    bool useGPU = backendName == "kk" || compareAll;
+    if (useGPU)
+    {
+        // Initialize OpenGL context: headless EGL by default, a GLFW window with --window
+        bool contextCreated = useWindow
+                                  ? context.createWindow(windowWidth, windowHeight, "OpenGL Line-Point Intersection")
+                                  : context.createHeadless();
+        if (!contextCreated)
+        {
+            std::cerr << "No OpenGL context, " << (compareAll ? "skipping KKIndex" : "falling back to the CPU backend") << std::endl;
+            useGPU = false;
+            if (!compareAll)
             {
-                LineVertex startVertex, endVertex;
-
-                // Determine the x-coordinates for the current line
-                if (y == start_y)
-                {
-                    startVertex.x = static_cast<float>(start_x);
-                    endVertex.x = static_cast<float>((y == end_y) ? end_x : this->viewPortWidth);
-                }
-                else if (y == end_y)
-                {
-                    startVertex.x = 0.0f;
-                    endVertex.x = static_cast<float>(end_x);
-                }
-                else
-                {
-                    startVertex.x = 0.0f;
-                    endVertex.x = static_cast<float>(this->viewPortWidth);
-                }
-
-                // Assign y-coordinates and query index
-                startVertex.y = static_cast<float>(y);
-                endVertex.y = static_cast<float>(y);
-                startVertex.queryIndex = queryIndex;
-                endVertex.queryIndex = queryIndex;
-
-                // Add the vertices to the lineVertices array
-                lineVertices.push_back(startVertex);
-                lineVertices.push_back(endVertex);
-
-                std::cout << "Line [" << startVertex.x << ", " << startVertex.y << ", " << startVertex.queryIndex << "] -> "
-                          << "[ " << endVertex.x << ", " << endVertex.y << ", " << endVertex.queryIndex << "] " << std::endl;
+                backendName = "cpu";
             }
         }
+    }
 
-        // Generate and bind a Vertex Array Object (VAO) for the lines
-        GLuint lineVAO, lineVBO;
-        glGenVertexArrays(1, &lineVAO);
-        glGenBuffers(1, &lineVBO);
-
-        glBindVertexArray(lineVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(LineVertex) * lineVertices.size(), lineVertices.data(), GL_STATIC_DRAW);
-
-        // Specify the layout of the vertex data
-        glEnableVertexAttribArray(0); // For data_x
-        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void *)offsetof(LineVertex, x));
-
-        glEnableVertexAttribArray(1); // For data_y
-        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void *)offsetof(LineVertex, y));
-
-        glEnableVertexAttribArray(2); // For queryIndex
-        glVertexAttribIPointer(2, 1, GL_INT, sizeof(LineVertex), (void *)offsetof(LineVertex, queryIndex));
-
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "line_creation_time: " << elapsed.count() << " ms" << std::endl;
-        std::cout << "no. of lines: " << lineVertices.size() << std::endl;
-
-        glBindVertexArray(lineVAO);
-        return lineVertices.size();
-    }
-
-    // int createLinesForQuery(int query_x1, int query_x2) {
-    //     std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-    //     struct LineVertex {
-    //         float x;
-    //         float y;
-    //     };
-
-    //     // modify the query_x1 and query_x2 so that point lookup can happen.
-    //     assert(query_x1 <= query_x2);
-    //     // query_x2 += 0.5;
-    //     auto query_range = query_x2 - query_x1;
-    //     if(query_range < 0.0) {
-    //         std::cerr << "query_x2 should be greater than query_x1" << std::endl;
-    //         return -1;
-    //     }
-    //     std::cout << "query_range: " << query_range << std::endl;
-    //     std::cout << "viewportSize: " << this->viewPortWidth * this->viewPortHeight << std::endl;
-    //     if(query_range >= this->viewPortWidth * this->viewPortHeight) {
-    //         std::cerr << "query range should be less than viewportWidth * viewportHeight" << std::endl;
-    //         return -1;
-    //     }
-
-    //     // Calculate starting point
-    //     int start_y = static_cast<int>(query_x1 / this->viewPortWidth) + 1;
-    //     int start_x = static_cast<int>(query_x1 - (start_y - 1) * this->viewPortWidth);
-
-    //     // Calculate ending point
-    //     int end_y = static_cast<int>(query_x2 / this->viewPortWidth) + 1;
-    //     int end_x = static_cast<int>(query_x2 - (end_y - 1) * this->viewPortWidth);
-
-    //     // Allocate line vertices array based on the viewport height
-    //     std::vector<LineVertex> lineVertices;
-
-    //     // Iterate from start_y to end_y to create lines
-    //     for (int y = start_y; y <= end_y; ++y) {
-    //         LineVertex startVertex, endVertex;
-
-    //         // Determine the x-coordinates for the current line
-    //         if (y == start_y) {
-    //             startVertex.x = static_cast<float>(start_x);
-    //             endVertex.x = static_cast<float>((y == end_y) ? end_x : this->viewPortWidth);
-    //         } else if (y == end_y) {
-    //             startVertex.x = 0.0f;
-    //             endVertex.x = static_cast<float>(end_x);
-    //         } else {
-    //             startVertex.x = 0.0f;
-    //             endVertex.x = static_cast<float>(this->viewPortWidth);
-    //         }
-
-    //         // Assign y-coordinates
-    //         startVertex.y = static_cast<float>(y);
-    //         endVertex.y = static_cast<float>(y);
-
-    //         // Add the vertices to the lineVertices array
-    //         lineVertices.push_back(startVertex);
-    //         lineVertices.push_back(endVertex);
-    //         // std::cout << "Line: (" << startVertex.x << ", " << startVertex.y << ") -> (" << endVertex.x << ", " << endVertex.y << ")" << std::endl;
-    //     }
-
-    //     // Generate and bind a Vertex Array Object (VAO) for the line
-    //     GLuint lineVAO, lineVBO;
-    //     glGenVertexArrays(1, &lineVAO);
-    //     glGenBuffers(1, &lineVBO);
-
-    //     glBindVertexArray(lineVAO);
-    //     glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-    //     glBufferData(GL_ARRAY_BUFFER, sizeof(LineVertex) * lineVertices.size(), lineVertices.data(), GL_STATIC_DRAW);
-
-    //     // Specify the layout of the vertex data
-    //     glEnableVertexAttribArray(0);  // For data_x
-    //     glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void*)offsetof(LineVertex, x));
-
-    //     glEnableVertexAttribArray(1);  // For data_y
-    //     glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void*)offsetof(LineVertex, y));
-    //     std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-    //     std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-    //     std::cout << "line_creation_time: " << elapsed.count() << " ms" << std::endl;
-    //     std::cout << "no. of lines: " << lineVertices.size() << std::endl;
-
-    //     glBindVertexArray(lineVAO);
-    //     return lineVertices.size();
-    // }
-
-    void setupDataSSBO(int size)
+    if (rectangleColumn >= 0)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        glGenBuffers(1, &dataSSBO);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
-
-        std::vector<ResultData> ssboData(size, {-1, -1});
-        glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(ResultData), nullptr, GL_DYNAMIC_COPY);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dataSSBO);
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-
-        glGenBuffers(1, &atomicCounterBuffer);
-        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
-
-        // Allocate storage for the atomic counter (initialize to zero)
-        GLuint zero = 0;
-        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
-        // Bind the atomic counter buffer to binding point 1 (matching the shader)
-        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, atomicCounterBuffer);
-
-        std::cout << "data_ssbo_setup_time: " << elapsed.count() << " ms" << std::endl;
+        if (!useGPU)
+        {
+            std::cerr << "--2d needs an OpenGL context" << std::endl;
+            return -1;
+        }
+        int status = runRectangleQueries(tableFile, rectangleColumn, zOrder, windowWidth, windowHeight, queryBounds);
+        context.destroy();
+        return status;
     }
 
-    // void setupDataSSBO(int size) {
-    //     std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-    //     glGenBuffers(1, &dataSSBO);
-    //     glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
+    std::vector<IndexBackend *> backends;
+    if (useGPU)
+    {
+        std::cout << "GL renderer: " << glGetString(GL_RENDERER) << ", version: " << glGetString(GL_VERSION) << std::endl;
 
-    //     std::cout << "here1" << std::endl;
-    //     std::vector<int> arr(size, -1);
-    //     std::cout << "here3" << std::endl;
-    //     glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof(int), arr.data(), GL_DYNAMIC_COPY);
-    //     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dataSSBO);
-    //     std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-    //     std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+        GLint maxBufferTextureSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxBufferTextureSize);
+        std::cout << "Maximum texture buffer size: " << maxBufferTextureSize << std::endl;
 
-    //     glGenBuffers(1, &atomicCounterBuffer);
-    //     glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
-    //     // Allocate storage for the atomic counter (initialize to zero)
-    //     GLuint zero = 0;
-    //     glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
-    //     // Bind the atomic counter buffer to binding point 1 (matching the shader)
-    //     glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, atomicCounterBuffer);
+        // Enable OpenGL debug output
+        glEnable(GL_DEBUG_OUTPUT);
 
-    //     std::cout << "data_ssbo_setup_time: " << elapsed.count() << " ms" << std::endl;
-    // }
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
 
-    int query(const std::vector<std::pair<int, int>> &queries)
-    {
-     std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-    
-        std::vector<Subquery> subqueries;
-    
-        if (queriesAreNonOverlapping) {
-            // Directly convert queries to subqueries without decomposition
-            int queryIndex = 0;
-            for (const auto& query : queries) {
-                Subquery subquery;
-                subquery.start = query.first;
-                subquery.end = query.second;
-                subquery.queryIndex = queryIndex++;
-                subquery.originalQueries.insert(queryIndex - 1);
-                subqueries.push_back(subquery);
-            }
-        } else {
-            // Perform decomposition for overlapping queries
-            subqueries = decomposeQueries(queries);
+        // A surfaceless context has no default framebuffer to clear.
+        if (useWindow)
+        {
+            glClear(GL_COLOR_BUFFER_BIT);
         }
-        
-        lastSubqueries = subqueries;
-
-        int lines = createLinesForQueries(subqueries);
 
-        glDrawArrays(GL_LINES, 0, lines);
+        glDebugMessageCallback(MessageCallback, 0);
 
-        glFinish();
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "query_time: " << elapsed.count() << " ms" << std::endl;
+        kkIndex.debug = debug;
+        kkIndex.rankCompressed = rankCompressed;
+        kkIndex.allowSubgroups = useSubgroups;
+        kkIndex.resultAllocation = resultAllocation;
 
-        // Bind the atomic counter buffer
-        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomicCounterBuffer);
-        int totalEntries = 0;
-        // Map the buffer to read the counter value
-        GLuint *counterValue = (GLuint *)glMapBuffer(GL_ATOMIC_COUNTER_BUFFER, GL_READ_ONLY);
-        if (counterValue)
-        {
-            totalEntries = *counterValue;
-            glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
-        }
-        else
+        kkIndex.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
+        if (engine == QueryEngine::Compute && !kkIndex.compileComputeShader(loadShaderCode("shader.comp").c_str()))
         {
-            // Handle error
-            std::cerr << "Failed to map atomic counter buffer for reading." << std::endl;
+            context.destroy();
+            return -1;
         }
+        kkIndex.engine = engine;
 
-        return totalEntries;
+        // The viewport size decides how the domain is tiled, so set it up first
+        kkIndex.setuptFrameBuffersAndViewPort(windowWidth, windowHeight, true);
+        backends.push_back(&kkIndex);
+    }
+    if (backendName == "cpu" || compareAll)
+    {
+        backends.push_back(&cpuIndex);
+    }
+    if (backendName == "btree" || compareAll)
+    {
+        backends.push_back(&btreeIndex);
+    }
+    if (backends.empty())
+    {
+        std::cerr << "Unknown backend: " << backendName << std::endl;
+        return -1;
     }
 
-    ResultData *getSSBOData()
+    // --snapshot: load KKIndex from the snapshot if it is of this table, else
+    // build it and write the snapshot. Serving from a snapshot skips the table.
+    IndexSnapshotSource snapshotTable = snapshotSource(tableFile, aggregate ? payloadColumn : -1);
+    bool kkFromSnapshot = useGPU && !snapshotFile.empty() && kkIndex.loadSnapshot(snapshotFile.c_str(), snapshotTable);
+    if (!snapshotFile.empty() && !useGPU)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataSSBO);
-        ResultData *ssboData = (ResultData *)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-        if (ssboData)
-        {
-            return ssboData;
-        }
-        else
-        {
-            // Handle error
-            std::cerr << "Failed to map SSBO for reading." << std::endl;
-            return nullptr;
-        }
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "ssbo_read_time: " << elapsed.count() << " ms" << std::endl;
+        std::cerr << "--snapshot needs the kk backend, ignoring it" << std::endl;
+    }
+    bool needTable = !kkFromSnapshot || backends.size() > 1 || serveSource.empty();
+    if (needTable && !table.load(tableFile, aggregate ? payloadColumn : -1))
+    {
+        context.destroy();
+        return -1;
     }
 
-    void check(const std::set<int> &uniqueValues, int query_x1, int query_x2)
+    for (IndexBackend *backend : backends)
     {
-        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
-        std::set<int> correctValues;
-        for (const auto &vertex : this->vertices)
+        if (backend == &kkIndex && kkFromSnapshot)
         {
-            if (vertex.indexValue >= query_x1 && vertex.indexValue < query_x2)
-            {
-                correctValues.insert(vertex.rowIdentifier);
-            }
+            std::cout << "backend " << backend->name() << ": loaded from " << snapshotFile << std::endl;
+            continue;
         }
-        std::cout << "correct values: " << correctValues.size() << std::endl;
-        if (correctValues == uniqueValues)
+        double buildTime = 0;
+        if (!buildBackend(*backend, table.keys, table.numRows, table.payload, buildTime))
         {
-            std::cout << "All values are correct!" << std::endl;
+            context.destroy();
+            return -1;
         }
-        else
+        std::cout << "backend " << backend->name() << ": build_time: " << buildTime << " ms" << std::endl;
+        if (backend == &kkIndex && !snapshotFile.empty())
         {
-            std::cerr << "Some values are incorrect!" << std::endl;
-
-            // print the query results.
-            // std::cout << "Unique values in SSBO:" << std::endl;
-            // for (const int& val : uniqueValues) {
-            //     std::cout << vertices[val].indexValue<< std::endl;
-            // }
-            // Find the incorrect values
-            std::set<int> incorrectValues;
-            std::set_difference(correctValues.begin(), correctValues.end(), uniqueValues.begin(), uniqueValues.end(), std::inserter(incorrectValues, incorrectValues.begin()));
-            std::set_difference(uniqueValues.begin(), uniqueValues.end(), correctValues.begin(), correctValues.end(), std::inserter(incorrectValues, incorrectValues.begin()));
-            for (const int &value : incorrectValues)
-            {
-                std::cerr << "Incorrect value: " << value;
-                if (correctValues.find(value) != correctValues.end())
-                {
-                    std::cerr << ", Value is present in correct values i.e not in result." << std::endl;
-                }
-                else
-                {
-                    std::cerr << ", Value is not present in correct values i.e in result." << std::endl;
-                }
-            }
-            std::cout << "Number of incorrect values: " << incorrectValues.size() << std::endl;
+            kkIndex.saveSnapshot(snapshotFile.c_str(), snapshotTable);
         }
-        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
-        std::cout << "check_time: " << elapsed.count() << " ms" << std::endl;
     }
-};
-
-// TOOD: think what to do when range_min is not 0.
-
-int main(int argc, char **argv)
-{
-    if (argc < 4 || ((argc - 2) % 2 != 0 && argc < 5)) {
-        std::cerr << "Usage: " << argv[0] << " <table_file> <query_x1 query_x2 ...> [--non-overlapping]" << std::endl;
-        return -1;
-    }
-
-    const char *tableFile = argv[1];
-
-    // Check for the flag at the end of arguments
-    int numQueryArgs = argc - 2;
-    if (std::string(argv[argc - 1]) == "--non-overlapping") {
-        queriesAreNonOverlapping = true;
-        numQueryArgs -= 1; // Exclude the flag from query arguments
+    IndexBackend *index = backends[0];
+
+    if (!serveSource.empty()) {
+        BatchResponder responder =
+            aggregate ? aggregateResponder(binaryFraming,
+                                           [index](const std::vector<std::pair<int, int>> &batch, bool nonOverlapping) {
+                                               return index->queryAggregates(batch, nonOverlapping);
+                                           })
+                      : rowResponder(binaryFraming,
+                                     [index](const std::vector<std::pair<int, int>> &batch, bool nonOverlapping) -> const QueryResults & {
+                                         return index->queryRows(batch, nonOverlapping);
+                                     });
+        // Keep up to pipelineDepth row batches in flight on the GPU
+        std::unique_ptr<QueryPipeline> pipeline;
+        StreamFinisher finisher;
+        if (pipelineDepth > 0 && index == &kkIndex && !aggregate) {
+            pipeline.reset(new QueryPipeline(kkIndex, pipelineDepth));
+            responder = pipelinedRowResponder(binaryFraming, *pipeline);
+            finisher = pipelineFinisher(*pipeline);
+        } else if (pipelineDepth > 0) {
+            std::cerr << "--pipeline needs the kk backend in row mode, serving synchronously" << std::endl;
+        }
+        int status = serveQueries(serveSource, binaryFraming, queriesAreNonOverlapping, responder, finisher);
+        pipeline.reset();
+        context.destroy();
+        return status;
     }
 
-    if (numQueryArgs % 2 != 0) {
-        std::cerr << "Error: Each query should have a start and end value." << std::endl;
-        return -1;
+    if (!joinTable.empty()) {
+        // The loaded table is the inner one; stream the outer table's keys
+        // through its index
+        TableSource outer;
+        if (!outer.load(joinTable.c_str()))
+        {
+            context.destroy();
+            return -1;
+        }
+        std::vector<JoinPair> pairs = indexNestedLoopJoin(*index, outer.keys, outer.numRows, 1 << 20);
+        checkJoin(outer.keys, outer.numRows, table.keys, table.numRows, pairs);
+        std::cout << "join pairs: " << pairs.size() << std::endl;
+        context.destroy();
+        return 0;
     }
 
-
-    // Initialize OpenGL context (using GLFW)
-    if (!glfwInit())
-    {
-        std::cerr << "GLFW initialization failed" << std::endl;
-        return -1;
+    if (lookup) {
+        // The values are probe keys; each must return the rows of [key, key + 1)
+        const QueryResults &lookupResults = index->lookupRows(queryBounds);
+        for (size_t i = 0; i < queryBounds.size(); i++)
+        {
+            int key = queryBounds[i];
+            check(table.keys, table.numRows, std::set<int>(lookupResults[i].begin(), lookupResults[i].end()), key, static_cast<long long>(key) + 1);
+        }
+        std::cout << "total (index) entries: " << lookupResults.totalRows() << std::endl;
+        context.destroy();
+        return 0;
     }
 
-    // Request OpenGL version 4.3 core profile
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    int windowWidth = 600;
-    int windowHeight = 400;
+    std::vector<std::pair<int, int>> queries;
 
-    // NOTE: change the window size from 10x10 to windowWidth x windowHeight when useFBO is false
-    // Create window
-    GLFWwindow *window = glfwCreateWindow(windowWidth, windowHeight, "OpenGL Line-Point Intersection", NULL, NULL);
-    if (!window)
-    {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+    for (size_t i = 0; i < queryBounds.size(); i += 2) {
+        queries.push_back({queryBounds[i], queryBounds[i + 1]});
     }
-    glfwMakeContextCurrent(window);
 
-    // Initialize GLEW after context creation
-    glewExperimental = GL_TRUE;
-    GLenum err = glewInit();
-    if (GLEW_OK != err)
-    {
-        std::cerr << "GLEW initialization failed: " << glewGetErrorString(err) << std::endl;
-        return -1;
+    if (backends.size() > 1) {
+        // Run the batch on every backend and continue with the fastest
+        int fastest = compareBackends(backends, queries, queriesAreNonOverlapping);
+        if (fastest < 0)
+        {
+            context.destroy();
+            return -1;
+        }
+        index = backends[fastest];
     }
 
-    GLint maxBufferTextureSize = 0;
-    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxBufferTextureSize);
-    std::cout << "Maximum texture buffer size: " << maxBufferTextureSize << std::endl;
-
-    // Enable OpenGL debug output
-    glEnable(GL_DEBUG_OUTPUT);
-
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    glDebugMessageCallback(MessageCallback, 0);
-
-    KKIndex kkIndex;
-
-    kkIndex.compileShaders(loadShaderCode("shader.vs").c_str(), loadShaderCode("shader.fs").c_str());
-
-    kkIndex.loadTableData(tableFile);
-
-    kkIndex.setUpTexture();
-
-    kkIndex.setuptFrameBuffersAndViewPort(windowWidth, windowHeight, true);
-
-    int ssboDataSize = windowWidth * windowHeight;
-    kkIndex.setupDataSSBO(ssboDataSize);
-
-    // TODO: take from the queries file.....
-    std::vector<std::pair<int, int>> queries;
-
-    for (int i = 2; i < argc; i += 2) {
-        int query_x1 = std::atoi(argv[i]);
-        int query_x2 = std::atoi(argv[i + 1]);
-        queries.push_back({query_x1, query_x2});
+    if (aggregate) {
+        std::vector<AggregateResult> aggregates = index->queryAggregates(queries, queriesAreNonOverlapping);
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            checkAggregate(table.keys, table.payload, table.numRows, aggregates[i], queries[i].first, queries[i].second);
+        }
+        context.destroy();
+        return 0;
     }
 
-    int totalEntries = kkIndex.query(queries, queriesAreNonOverlapping);
-
-    // int width, height;
-    // glfwGetWindowSize(window, &width, &height);
-    // std::cout << "window width: " << width << std::endl;
-    // std::cout << "window height: " << height << std::endl;
-
-    // main loop.
-    // while (!glfwWindowShouldClose(window))
-    // {
-    //     int totalEntries = kkIndex.query(queries);
-    //     glfwSwapBuffers(window);
-    //     glfwPollEvents();
-    // }
-
-    ResultData *ssboData = kkIndex.getSSBOData();
-
-    size_t numQueries = queries.size();
+    const QueryResults &queryResults = index->queryRows(queries, queriesAreNonOverlapping);
 
-    // Initialize a vector of sets, one set per query
-    std::vector<std::set<int>> queryResults(numQueries);
-
-    auto subqueries = kkIndex.lastSubqueries;
-    // Process the SSBO data
-    for (GLuint i = 0; i < std::min(ssboDataSize, totalEntries); ++i)
+    size_t totalEntries = 0;
+    // for each query, check with check()
+    for (size_t i = 0; i < queries.size(); i++)
     {
-        int subqueryIndex = ssboData[i].queryIndex;
-        int rowIdentifier = ssboData[i].rowIdentifier;
-
-        // Get the subquery
-        const Subquery& subquery = subqueries[subqueryIndex];
-
-        // For each original query this subquery belongs to
-        for (int originalQueryIndex : subquery.originalQueries) {
-            queryResults[originalQueryIndex].insert(rowIdentifier);
+        totalEntries += queryResults[i].size();
+        check(table.keys, table.numRows, std::set<int>(queryResults[i].begin(), queryResults[i].end()), queries[i].first, queries[i].second);
+        if (index == &kkIndex && resultAllocation == ResultAllocation::Ordered && checkKeyOrder(table.keys, queryResults[i]))
+        {
+            std::cout << "Rows are in key order" << std::endl;
         }
     }
-    // for each query, check with kkIndex.check()
-    for (int i = 0; i < numQueries; i++)
-    {
-        kkIndex.check(queryResults[i], queries[i].first, queries[i].second);
-    }
 
     // Print the unique values
     // std::cout << "Unique values in SSBO:" << std::endl;
@@ -881,6 +648,6 @@ int main(int argc, char **argv)
     // std::cout << "query_size: " << query_x2 - query_x1 << std::endl;
 
     // Clean up and exit
-    glfwTerminate();
+    context.destroy();
     return 0;
 }
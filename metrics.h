@@ -0,0 +1,149 @@
+#pragma once
+
+// Per-stage timing. Every timed stage of the pipeline reports through a
+// StageTimer (or kk_index.h's GpuStageTimer, which adds the GPU time of the
+// stage), which logs the usual line
+//
+//   query_time: 2.5 ms, gpu: 2.1 ms
+//
+// and, while a sink file is open, appends one structured record to it:
+//
+//   JsonLines:   {"stage": "query_time", "start_us": 1234.5, "cpu_ms": 2.5, "gpu_ms": 2.1}
+//   ChromeTrace: a JSON array of complete ("X") events for chrome://tracing
+//                or Perfetto, CPU stages on thread 1 and the GPU time of GPU
+//                stages on thread 2, starting with the stage's CPU start.
+//
+// gpu_ms is left out for stages without GPU work. Times are relative to the
+// moment the sink was opened.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+class MetricsSink
+{
+public:
+    enum class Format
+    {
+        JsonLines,
+        ChromeTrace
+    };
+
+    bool open(const char *filename, Format format)
+    {
+        close();
+        this->out.open(filename);
+        if (!this->out)
+        {
+            std::cerr << "Failed to open metrics file " << filename << std::endl;
+            return false;
+        }
+        this->format = format;
+        this->firstEvent = true;
+        this->origin = std::chrono::high_resolution_clock::now();
+        if (format == Format::ChromeTrace)
+        {
+            this->out << "[" << std::endl;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (!this->out.is_open())
+        {
+            return;
+        }
+        if (this->format == Format::ChromeTrace)
+        {
+            this->out << std::endl << "]" << std::endl;
+        }
+        this->out.close();
+    }
+
+    bool isOpen() const { return this->out.is_open(); }
+
+    // gpuMs < 0 means the stage did no GPU work
+    void record(const std::string &stage, std::chrono::high_resolution_clock::time_point start, double cpuMs, double gpuMs)
+    {
+        if (!this->out.is_open())
+        {
+            return;
+        }
+        std::chrono::duration<double, std::micro> startUs = start - this->origin;
+        if (this->format == Format::JsonLines)
+        {
+            this->out << "{\"stage\": \"" << stage << "\", \"start_us\": " << startUs.count() << ", \"cpu_ms\": " << cpuMs;
+            if (gpuMs >= 0)
+            {
+                this->out << ", \"gpu_ms\": " << gpuMs;
+            }
+            this->out << "}" << std::endl;
+            return;
+        }
+        writeTraceEvent(stage, 1, startUs.count(), cpuMs);
+        if (gpuMs >= 0)
+        {
+            writeTraceEvent(stage, 2, startUs.count(), gpuMs);
+        }
+    }
+
+    ~MetricsSink() { close(); }
+
+private:
+    std::ofstream out;
+    Format format = Format::JsonLines;
+    bool firstEvent = true;
+    std::chrono::high_resolution_clock::time_point origin;
+
+    void writeTraceEvent(const std::string &stage, int thread, double startUs, double durationMs)
+    {
+        this->out << (this->firstEvent ? "" : ",\n") << "{\"name\": \"" << stage << "\", \"cat\": \""
+                  << (thread == 1 ? "cpu" : "gpu") << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread
+                  << ", \"ts\": " << startUs << ", \"dur\": " << durationMs * 1000.0 << "}";
+        this->firstEvent = false;
+    }
+};
+
+// The process-wide sink; closed (and the trace terminated) at exit
+inline MetricsSink &metricsSink()
+{
+    static MetricsSink sink;
+    return sink;
+}
+
+// Times one stage on the CPU from construction to stop()
+class StageTimer
+{
+public:
+    explicit StageTimer(const char *stage) : stage(stage), startTime(std::chrono::high_resolution_clock::now()) {}
+
+    // Logs and records the stage; a non-empty detail is appended to the log
+    // line. Returns the CPU time in ms.
+    double stop(const std::string &detail = "")
+    {
+        return finish(std::chrono::high_resolution_clock::now(), -1.0, detail);
+    }
+
+protected:
+    const char *stage;
+    std::chrono::high_resolution_clock::time_point startTime;
+
+    double finish(std::chrono::high_resolution_clock::time_point endTime, double gpuMs, const std::string &detail)
+    {
+        std::chrono::duration<double, std::milli> elapsed = endTime - this->startTime;
+        std::cout << this->stage << ": " << elapsed.count() << " ms";
+        if (gpuMs >= 0)
+        {
+            std::cout << ", gpu: " << gpuMs << " ms";
+        }
+        if (!detail.empty())
+        {
+            std::cout << " " << detail;
+        }
+        std::cout << std::endl;
+        metricsSink().record(this->stage, this->startTime, elapsed.count(), gpuMs);
+        return elapsed.count();
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+// Decomposition of a batch of possibly overlapping range queries into
+// disjoint subqueries.
+//
+// The sorted, distinct query endpoints cut the key space into elementary
+// intervals. Every interval covered by at least one query becomes a
+// subquery, so each key is rasterized once per batch no matter how many
+// queries contain it. Which original queries a subquery belongs to is kept
+// in CSR form: the members of subquery i are
+// members[memberOffsets[i] .. memberOffsets[i + 1]), in ascending order.
+//
+// Building it is a sweep over the endpoints: every query adds +1 at its
+// first interval and -1 past its last one, a prefix sum over these deltas
+// gives the number of queries covering each interval (the CSR offsets), and
+// a second pass over the queries fills the members. Cost is
+// O((E + Q) log E + M) for E endpoints, Q queries and M memberships.
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+struct Subquery
+{
+    int start;
+    int end;
+    int queryIndex; // Index of the subquery within its batch
+};
+
+struct QueryDecomposition
+{
+    std::vector<Subquery> subqueries;
+    std::vector<int> memberOffsets; // One per subquery plus one
+    std::vector<int> members;       // Original query indices, grouped by subquery
+
+    const int *membersBegin(size_t subquery) const { return members.data() + memberOffsets[subquery]; }
+    const int *membersEnd(size_t subquery) const { return members.data() + memberOffsets[subquery + 1]; }
+};
+
+// One subquery per query; for batches known not to overlap.
+inline QueryDecomposition directSubqueries(const std::vector<std::pair<int, int>> &queries)
+{
+    QueryDecomposition decomposition;
+    decomposition.subqueries.resize(queries.size());
+    decomposition.memberOffsets.resize(queries.size() + 1);
+    decomposition.members.resize(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        decomposition.subqueries[q] = Subquery{queries[q].first, queries[q].second, static_cast<int>(q)};
+        decomposition.memberOffsets[q] = static_cast<int>(q);
+        decomposition.members[q] = static_cast<int>(q);
+    }
+    decomposition.memberOffsets[queries.size()] = static_cast<int>(queries.size());
+    return decomposition;
+}
+
+inline QueryDecomposition decomposeQueries(const std::vector<std::pair<int, int>> &queries)
+{
+    QueryDecomposition decomposition;
+
+    // Collect all query endpoints, sorted and without duplicates
+    std::vector<int> endpoints;
+    endpoints.reserve(2 * queries.size());
+    for (const auto &query : queries)
+    {
+        endpoints.push_back(query.first);
+        endpoints.push_back(query.second);
+    }
+    std::sort(endpoints.begin(), endpoints.end());
+    endpoints.erase(std::unique(endpoints.begin(), endpoints.end()), endpoints.end());
+    if (endpoints.size() < 2)
+    {
+        decomposition.memberOffsets.push_back(0);
+        return decomposition;
+    }
+    const size_t numIntervals = endpoints.size() - 1;
+
+    // Elementary interval i is [endpoints[i], endpoints[i + 1]). Query q
+    // covers intervals [firstInterval[q], lastInterval[q]); empty and
+    // inverted queries cover none.
+    std::vector<int> firstInterval(queries.size());
+    std::vector<int> lastInterval(queries.size());
+    std::vector<int> coverage(numIntervals + 1, 0);
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        int first = static_cast<int>(std::lower_bound(endpoints.begin(), endpoints.end(), queries[q].first) - endpoints.begin());
+        int last = static_cast<int>(std::lower_bound(endpoints.begin(), endpoints.end(), queries[q].second) - endpoints.begin());
+        if (last <= first)
+        {
+            last = first;
+        }
+        firstInterval[q] = first;
+        lastInterval[q] = last;
+        coverage[first] += 1;
+        coverage[last] -= 1;
+    }
+
+    // Sweep: the running sum is the number of queries covering an interval.
+    // Covered intervals become subqueries; intervalCursor holds the next
+    // member slot of an interval's subquery.
+    std::vector<int> intervalCursor(numIntervals, -1);
+    decomposition.memberOffsets.push_back(0);
+    int active = 0;
+    for (size_t i = 0; i < numIntervals; ++i)
+    {
+        active += coverage[i];
+        if (active == 0)
+        {
+            continue;
+        }
+        intervalCursor[i] = decomposition.memberOffsets.back();
+        decomposition.subqueries.push_back(Subquery{endpoints[i], endpoints[i + 1], static_cast<int>(decomposition.subqueries.size())});
+        decomposition.memberOffsets.push_back(decomposition.memberOffsets.back() + active);
+    }
+
+    // Visiting the queries in order keeps every member list sorted
+    decomposition.members.resize(decomposition.memberOffsets.back());
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        for (int i = firstInterval[q]; i < lastInterval[q]; ++i)
+        {
+            decomposition.members[intervalCursor[i]++] = static_cast<int>(q);
+        }
+    }
+    return decomposition;
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+// QueryPipeline: answers batches on a KKIndex without waiting for each one,
+// so the CPU decomposes and lays out the lines of batch N+1 while the GPU is
+// still rasterizing batch N.
+//
+// Up to `depth` batches are in flight. Each owns a slot with its own result
+// SSBO, atomic counter and compute chunk buffer, and draws from its own
+// section of the index's line ring. A batch is submitted with a single
+// materializing pass into its slot (no counting pass, which would need a
+// readback), followed by a glFenceSync. It completes once the fence has
+// signalled: the counter and the rows are read back without stalling, and
+// the callback receives the results. A batch that overflowed its slot
+// grows it and is run again synchronously; the slot keeps its size, so
+// this only happens while the slots warm up.
+//
+// Everything runs on the thread that owns the GL context. Callbacks run in
+// submission order, from submit() (when it needs a slot), poll() or drain().
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "kk_index.h"
+#include "metrics.h"
+#include "query_results.h"
+#include "query_server.h"
+
+// Receives the results of one batch; they are only valid during the call.
+typedef std::function<void(const QueryResults &results)> BatchCallback;
+
+class QueryPipeline
+{
+public:
+    // depth is clamped to the sections of the index's line ring
+    QueryPipeline(KKIndex &index, int depth) : index(index)
+    {
+        depth = std::max(1, std::min(depth, KKIndex::kLineRingSections));
+        this->slots.resize(depth);
+        for (int s = 0; s < depth; ++s)
+        {
+            Slot &slot = this->slots[s];
+            slot.capacity = std::max(this->index.ssboCapacity, 1);
+            glGenBuffers(1, &slot.resultSSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.resultSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, slot.capacity * sizeof(ResultData), nullptr, GL_DYNAMIC_COPY);
+            GLuint zero = 0;
+            glGenBuffers(1, &slot.counterBuffer);
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, slot.counterBuffer);
+            glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
+            glGenBuffers(1, &slot.chunkSSBO);
+            this->freeSlots.push_back(s);
+        }
+        std::cout << "pipeline depth: " << depth << ", slot capacity: " << this->slots[0].capacity << " entries" << std::endl;
+    }
+
+    ~QueryPipeline()
+    {
+        drain();
+        for (Slot &slot : this->slots)
+        {
+            glDeleteBuffers(1, &slot.resultSSBO);
+            glDeleteBuffers(1, &slot.counterBuffer);
+            glDeleteBuffers(1, &slot.chunkSSBO);
+        }
+    }
+
+    // Starts a batch. If every slot is in flight, first waits for the oldest
+    // batch and delivers it.
+    void submit(const std::vector<std::pair<int, int>> &queries, bool queriesAreNonOverlapping, BatchCallback callback)
+    {
+        if (this->freeSlots.empty())
+        {
+            complete(this->inFlight.front());
+            this->inFlight.pop_front();
+        }
+        int s = this->freeSlots.back();
+        this->freeSlots.pop_back();
+        Slot &slot = this->slots[s];
+
+        StageTimer timer("pipeline_submit_time");
+        slot.numQueries = queries.size();
+        slot.callback = std::move(callback);
+        this->index.useProgram(this->index.engine == QueryEngine::Compute ? this->index.computeProgram : this->index.shaderProgram);
+        this->index.setCountOnly(false);
+        this->index.setOrdered(false);
+        this->index.buildSubqueries(queries, queriesAreNonOverlapping);
+        std::swap(slot.decomposition, this->index.lastDecomposition);
+
+        bindSlot(slot);
+        bool prepared = this->index.prepareTiles(slot.decomposition.subqueries);
+        if (prepared)
+        {
+            this->index.resetCounter();
+            this->index.runPreparedTiles();
+            // Make the shader writes visible to the host reads at completion
+            glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+        unbindSlot(slot);
+        timer.stop("(" + std::to_string(this->inFlight.size() + 1) + " in flight)");
+
+        if (!prepared)
+        {
+            std::cerr << "Failed to prepare the batch" << std::endl;
+            slot.results.offsets.assign(slot.numQueries + 1, 0);
+            slot.results.rows.clear();
+            slot.callback(slot.results);
+            this->freeSlots.push_back(s);
+            return;
+        }
+        this->inFlight.push_back(s);
+    }
+
+    // Delivers the batches that have finished, without waiting. Returns the
+    // number delivered.
+    int poll()
+    {
+        int delivered = 0;
+        while (!this->inFlight.empty())
+        {
+            GLenum status = glClientWaitSync(this->slots[this->inFlight.front()].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                break;
+            }
+            complete(this->inFlight.front());
+            this->inFlight.pop_front();
+            ++delivered;
+        }
+        return delivered;
+    }
+
+    // Waits for and delivers every batch in flight.
+    void drain()
+    {
+        while (!this->inFlight.empty())
+        {
+            complete(this->inFlight.front());
+            this->inFlight.pop_front();
+        }
+    }
+
+    size_t batchesInFlight() const { return this->inFlight.size(); }
+
+private:
+    struct Slot
+    {
+        GLuint resultSSBO = 0;
+        GLuint counterBuffer = 0;
+        GLuint chunkSSBO = 0;
+        int capacity = 0;         // Entries resultSSBO holds
+        size_t chunkCapacity = 0; // RangeChunks chunkSSBO holds
+        GLsync fence = nullptr;
+        size_t numQueries = 0;
+        QueryDecomposition decomposition;
+        BatchCallback callback;
+        QueryResults results;
+    };
+
+    // The index's own buffers while a slot is bound
+    struct IndexBuffers
+    {
+        GLuint resultSSBO;
+        GLuint counterBuffer;
+        GLuint chunkSSBO;
+        int capacity;
+        size_t chunkCapacity;
+    };
+
+    KKIndex &index;
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    std::deque<int> inFlight; // Slots in submission order
+    IndexBuffers saved;
+
+    // Points the index (and bindings 0 and 1) at the slot's buffers
+    void bindSlot(Slot &slot)
+    {
+        this->saved = {this->index.dataSSBO, this->index.atomicCounterBuffer, this->index.chunkSSBO, this->index.ssboCapacity,
+                       this->index.chunkCapacity};
+        this->index.dataSSBO = slot.resultSSBO;
+        this->index.atomicCounterBuffer = slot.counterBuffer;
+        this->index.chunkSSBO = slot.chunkSSBO;
+        this->index.ssboCapacity = slot.capacity;
+        this->index.chunkCapacity = slot.chunkCapacity;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, slot.resultSSBO);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, slot.counterBuffer);
+    }
+
+    // Keeps what the index grew and gives it its own buffers back
+    void unbindSlot(Slot &slot)
+    {
+        slot.resultSSBO = this->index.dataSSBO;
+        slot.capacity = this->index.ssboCapacity;
+        slot.chunkCapacity = this->index.chunkCapacity;
+        this->index.dataSSBO = this->saved.resultSSBO;
+        this->index.atomicCounterBuffer = this->saved.counterBuffer;
+        this->index.chunkSSBO = this->saved.chunkSSBO;
+        this->index.ssboCapacity = this->saved.capacity;
+        this->index.chunkCapacity = this->saved.chunkCapacity;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->index.dataSSBO);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 1, this->index.atomicCounterBuffer);
+    }
+
+    // Waits for the slot's batch, reads it back and delivers it
+    void complete(int s)
+    {
+        Slot &slot = this->slots[s];
+        StageTimer waitTimer("pipeline_wait_time");
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        waitTimer.stop();
+
+        StageTimer timer("pipeline_readback_time");
+        bindSlot(slot);
+        GLuint totalEntries = this->index.readCounter();
+        if (totalEntries > static_cast<GLuint>(slot.capacity))
+        {
+            // Overflowed: the counter holds the exact size, so one rerun fits
+            std::cout << "pipeline slot overflow (" << totalEntries << " > " << slot.capacity << "), rerunning" << std::endl;
+            this->index.ensureResultCapacity(totalEntries);
+            this->index.useProgram(this->index.engine == QueryEngine::Compute ? this->index.computeProgram : this->index.shaderProgram);
+            this->index.setCountOnly(false);
+            this->index.setOrdered(false);
+            this->index.prepareTiles(slot.decomposition.subqueries);
+            this->index.resetCounter();
+            this->index.runPreparedTiles();
+            totalEntries = this->index.readCounter();
+        }
+
+        ResultData *ssboData = this->index.getSSBOData();
+        if (ssboData)
+        {
+            size_t availableEntries = std::min<size_t>(totalEntries, this->index.ssboCapacity);
+            assembleQueryResults(ssboData, availableEntries, slot.decomposition, slot.numQueries, slot.results);
+            this->index.releaseSSBOData();
+        }
+        else
+        {
+            slot.results.offsets.assign(slot.numQueries + 1, 0);
+            slot.results.rows.clear();
+        }
+        unbindSlot(slot);
+        timer.stop();
+
+        BatchCallback callback = std::move(slot.callback);
+        this->freeSlots.push_back(s);
+        callback(slot.results);
+    }
+};
+
+// Responds through a pipeline: the response of a batch is written when the
+// batch completes, during a later batch or when the stream ends (see
+// pipelineFinisher). rows counts the rows written during the call.
+inline BatchResponder pipelinedRowResponder(bool binary, QueryPipeline &pipeline)
+{
+    std::shared_ptr<bool> failed = std::make_shared<bool>(false);
+    std::shared_ptr<size_t> rowsWritten = std::make_shared<size_t>(0);
+    return [binary, &pipeline, failed, rowsWritten](int outFd, const std::vector<std::pair<int, int>> &queries, bool nonOverlapping,
+                                                    size_t &rows) {
+        *rowsWritten = 0;
+        pipeline.submit(queries, nonOverlapping, [binary, outFd, failed, rowsWritten](const QueryResults &results) {
+            *rowsWritten += results.totalRows();
+            if (!*failed)
+            {
+                *failed = !(binary ? writeBinaryResults(outFd, results) : writeTextResults(outFd, results));
+            }
+        });
+        pipeline.poll();
+        rows = *rowsWritten;
+        return !*failed;
+    };
+}
+
+// Writes the responses still in flight at the end of a stream
+inline StreamFinisher pipelineFinisher(QueryPipeline &pipeline)
+{
+    return [&pipeline]() {
+        pipeline.drain();
+        return true;
+    };
+}
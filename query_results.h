@@ -0,0 +1,235 @@
+#pragma once
+
+// Result types shared by the index and the query server, and the host-side
+// assembly of a batch's row identifiers.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "query_decomposition.h"
+
+// One entry of the result SSBO (ResultData in shader.fs)
+struct ResultData
+{
+    int queryIndex; // Subquery that produced the row
+    int rowIdentifier;
+};
+
+// COUNT(*), SUM, MIN and MAX of the payload column over one query's rows.
+// min and max are 0 when count is 0.
+struct AggregateResult
+{
+    int64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+};
+
+// One output row of a join: a row of the outer (probing) table and a row
+// of the inner (indexed) table with the same key
+struct JoinPair
+{
+    int outerRow;
+    int innerRow;
+};
+
+// A view of one query's row identifiers
+struct RowSpan
+{
+    const int *first;
+    const int *last;
+
+    const int *begin() const { return first; }
+    const int *end() const { return last; }
+    const int *data() const { return first; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+};
+
+// The row identifiers of every query of a batch in one contiguous buffer:
+// query q's rows are rows[offsets[q] .. offsets[q + 1]), in ascending order.
+// Reusing one QueryResults across batches keeps its buffers, so assembling a
+// batch allocates nothing once they are large enough.
+struct QueryResults
+{
+    std::vector<size_t> offsets; // One per query plus one
+    std::vector<int> rows;
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    size_t totalRows() const { return offsets.empty() ? 0 : offsets.back(); }
+    RowSpan operator[](size_t query) const { return RowSpan{rows.data() + offsets[query], rows.data() + offsets[query + 1]}; }
+};
+
+// Scatters the numEntries SSBO entries of a batch into results: every entry
+// is copied to each original query its subquery belongs to. Each worker
+// counts its slice of the entries per subquery; a prefix sum over
+// (query, worker) gives every worker its own write cursor per query, so the
+// scatter needs no atomics. Rows of a query are then sorted, queries spread
+// over the workers. numThreads 0 means one per hardware thread.
+inline void assembleQueryResults(const ResultData *entries, size_t numEntries, const QueryDecomposition &decomposition,
+                                 size_t numQueries, QueryResults &results, int numThreads = 0)
+{
+    const size_t numSubqueries = decomposition.subqueries.size();
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Small batches are not worth the thread start-up
+    const size_t minEntriesPerThread = 1 << 16;
+    numThreads = static_cast<int>(std::max<size_t>(1, std::min<size_t>(numThreads, numEntries / minEntriesPerThread)));
+
+    auto runWorkers = [numThreads](auto &&work) {
+        if (numThreads == 1)
+        {
+            work(0);
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (int t = 0; t < numThreads; ++t)
+        {
+            workers.emplace_back(work, t);
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    };
+    auto sliceBegin = [numEntries, numThreads](int t) { return numEntries * t / numThreads; };
+
+    // Hits per (worker, subquery)
+    std::vector<size_t> subqueryCounts(static_cast<size_t>(numThreads) * numSubqueries, 0);
+    runWorkers([&](int t) {
+        size_t *counts = subqueryCounts.data() + t * numSubqueries;
+        for (size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i)
+        {
+            counts[entries[i].queryIndex]++;
+        }
+    });
+
+    // cursors[t * numQueries + q] becomes worker t's first slot for query q.
+    // Each worker first spreads its own subquery counts over the queries;
+    // it only writes its own row of cursors.
+    std::vector<size_t> cursors(static_cast<size_t>(numThreads) * numQueries, 0);
+    runWorkers([&](int t) {
+        const size_t *counts = subqueryCounts.data() + t * numSubqueries;
+        size_t *threadCursors = cursors.data() + t * numQueries;
+        for (size_t s = 0; s < numSubqueries; ++s)
+        {
+            if (counts[s] == 0)
+            {
+                continue;
+            }
+            for (const int *member = decomposition.membersBegin(s); member != decomposition.membersEnd(s); ++member)
+            {
+                threadCursors[*member] += counts[s];
+            }
+        }
+    });
+    results.offsets.resize(numQueries + 1);
+    size_t total = 0;
+    for (size_t q = 0; q < numQueries; ++q)
+    {
+        results.offsets[q] = total;
+        for (int t = 0; t < numThreads; ++t)
+        {
+            size_t count = cursors[t * numQueries + q];
+            cursors[t * numQueries + q] = total;
+            total += count;
+        }
+    }
+    results.offsets[numQueries] = total;
+    results.rows.resize(total);
+
+    runWorkers([&](int t) {
+        size_t *threadCursors = cursors.data() + t * numQueries;
+        int *rows = results.rows.data();
+        for (size_t i = sliceBegin(t); i < sliceBegin(t + 1); ++i)
+        {
+            int subquery = entries[i].queryIndex;
+            for (const int *member = decomposition.membersBegin(subquery); member != decomposition.membersEnd(subquery); ++member)
+            {
+                rows[threadCursors[*member]++] = entries[i].rowIdentifier;
+            }
+        }
+    });
+
+    std::atomic<size_t> nextQuery(0);
+    runWorkers([&](int) {
+        for (size_t q = nextQuery++; q < numQueries; q = nextQuery++)
+        {
+            std::sort(results.rows.begin() + results.offsets[q], results.rows.begin() + results.offsets[q + 1]);
+        }
+    });
+}
+
+// Groups the numEntries SSBO entries of a lookup batch by probe: the query
+// index of an entry is its probe, so one count per probe, a prefix sum and a
+// scatter place every row; no decomposition is involved. A probe's rows are
+// then sorted, which only matters for keys with several rows.
+inline void assembleProbeResults(const ResultData *entries, size_t numEntries, size_t numProbes, QueryResults &results)
+{
+    results.offsets.assign(numProbes + 1, 0);
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        results.offsets[entries[i].queryIndex + 1]++;
+    }
+    for (size_t p = 0; p < numProbes; ++p)
+    {
+        results.offsets[p + 1] += results.offsets[p];
+    }
+    results.rows.resize(numEntries);
+
+    std::vector<size_t> cursors(results.offsets.begin(), results.offsets.end() - 1);
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        results.rows[cursors[entries[i].queryIndex]++] = entries[i].rowIdentifier;
+    }
+    for (size_t p = 0; p < numProbes; ++p)
+    {
+        if (results.offsets[p + 1] - results.offsets[p] > 1)
+        {
+            std::sort(results.rows.begin() + results.offsets[p], results.rows.begin() + results.offsets[p + 1]);
+        }
+    }
+}
+
+// Gathers a batch written in ordered mode: subquery s's rows are the
+// entries [subqueryOffsets[s], subqueryOffsets[s + 1]), already in key
+// order, and subqueries come in ascending key order. Each query is the
+// concatenation of its subqueries' slices, so it stays key ordered; nothing
+// is sorted.
+inline void assembleOrderedResults(const ResultData *entries, const std::vector<size_t> &subqueryOffsets,
+                                   const QueryDecomposition &decomposition, size_t numQueries, QueryResults &results)
+{
+    const size_t numSubqueries = decomposition.subqueries.size();
+    results.offsets.assign(numQueries + 1, 0);
+    for (size_t s = 0; s < numSubqueries; ++s)
+    {
+        for (const int *member = decomposition.membersBegin(s); member != decomposition.membersEnd(s); ++member)
+        {
+            results.offsets[*member + 1] += subqueryOffsets[s + 1] - subqueryOffsets[s];
+        }
+    }
+    for (size_t q = 0; q < numQueries; ++q)
+    {
+        results.offsets[q + 1] += results.offsets[q];
+    }
+    results.rows.resize(results.offsets[numQueries]);
+
+    std::vector<size_t> cursors(results.offsets.begin(), results.offsets.end() - 1);
+    for (size_t s = 0; s < numSubqueries; ++s)
+    {
+        for (const int *member = decomposition.membersBegin(s); member != decomposition.membersEnd(s); ++member)
+        {
+            int *out = results.rows.data() + cursors[*member];
+            for (size_t i = subqueryOffsets[s]; i < subqueryOffsets[s + 1]; ++i)
+            {
+                *out++ = entries[i].rowIdentifier;
+            }
+            cursors[*member] += subqueryOffsets[s + 1] - subqueryOffsets[s];
+        }
+    }
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+// Long-running query serving: the index is built once and query batches are
+// read from stdin, a file or a local UNIX socket.
+//
+// Text framing (the format written by tpch_1GB/queries.py):
+//   request   one "x1 x2" query per line; a blank line or EOF ends the batch.
+//             Lines starting with '#' are ignored.
+//   response  one line per query: "<count> <row> <row> ...", then a blank line.
+//
+// Binary framing (native-endian 32-bit words):
+//   request   uint32 numQueries, uint32 flags, then numQueries (int32 x1, int32 x2)
+//             pairs. flags bit 0 marks the batch as non-overlapping.
+//             numQueries == 0 or EOF ends the stream. A batch holds at most
+//             kMaxBinaryBatchQueries queries; a larger numQueries is
+//             rejected and ends the stream.
+//   response  uint32 numQueries, uint32 count[numQueries], then all int32 row
+//             identifiers, query by query.
+//
+// In aggregate mode only the responses change:
+//   text      one "<count> <sum> <min> <max>" line per query, then a blank line.
+//   binary    uint32 numQueries, then per query int64 count, int64 sum,
+//             int32 min, int32 max (24 bytes).
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "query_results.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Answers one batch: returns the row identifiers of each query.
+typedef std::function<const QueryResults &(const std::vector<std::pair<int, int>> &queries, bool nonOverlapping)> BatchHandler;
+
+// Answers one batch in aggregate mode: returns the aggregates of each query.
+typedef std::function<std::vector<AggregateResult>(const std::vector<std::pair<int, int>> &queries, bool nonOverlapping)> AggregateHandler;
+
+// Answers one batch and writes the response to outFd. Sets rows to the number
+// of matching rows; returns false if the response could not be written.
+typedef std::function<bool(int outFd, const std::vector<std::pair<int, int>> &queries, bool nonOverlapping, size_t &rows)> BatchResponder;
+
+// Called at the end of every stream, for responders that write responses
+// after returning (see query_pipeline.h). Returns false if a response could
+// not be written.
+typedef std::function<bool()> StreamFinisher;
+
+class FdReader
+{
+public:
+    explicit FdReader(int fd) : fd(fd) {}
+
+    // Reads one line without the trailing '\n'. Returns false at end of input.
+    bool readLine(std::string &line)
+    {
+        line.clear();
+        while (true)
+        {
+            if (pos == len && !fill())
+            {
+                return !line.empty();
+            }
+            const char *begin = buffer + pos;
+            const char *newline = static_cast<const char *>(std::memchr(begin, '\n', len - pos));
+            if (newline)
+            {
+                line.append(begin, newline - begin);
+                pos += (newline - begin) + 1;
+                return true;
+            }
+            line.append(begin, len - pos);
+            pos = len;
+        }
+    }
+
+    // Reads exactly size bytes. Returns false on a short read.
+    bool readExact(void *data, size_t size)
+    {
+        char *out = static_cast<char *>(data);
+        while (size > 0)
+        {
+            if (pos == len && !fill())
+            {
+                return false;
+            }
+            size_t chunk = std::min(size, len - pos);
+            std::memcpy(out, buffer + pos, chunk);
+            pos += chunk;
+            out += chunk;
+            size -= chunk;
+        }
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        ssize_t bytes;
+        do
+        {
+            bytes = ::read(fd, buffer, sizeof(buffer));
+        } while (bytes < 0 && errno == EINTR);
+        pos = 0;
+        len = bytes > 0 ? static_cast<size_t>(bytes) : 0;
+        return len > 0;
+    }
+
+    int fd;
+    char buffer[1 << 16];
+    size_t pos = 0;
+    size_t len = 0;
+};
+
+inline bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t bytes = ::write(fd, p, size);
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            return false;
+        }
+        p += bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+// Reads the next text batch. Returns false when the input is exhausted.
+inline bool readTextBatch(FdReader &reader, std::vector<std::pair<int, int>> &queries)
+{
+    queries.clear();
+    std::string line;
+    bool sawInput = false;
+    while (reader.readLine(line))
+    {
+        sawInput = true;
+        if (line.empty())
+        {
+            if (queries.empty())
+            {
+                continue; // Tolerate repeated blank lines between batches
+            }
+            return true;
+        }
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        const char *p = line.c_str();
+        const char *end = p + line.size();
+        int x1 = 0, x2 = 0;
+        while (p < end && *p == ' ')
+            ++p;
+        std::from_chars_result first = std::from_chars(p, end, x1);
+        p = first.ptr;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            ++p;
+        std::from_chars_result second = std::from_chars(p, end, x2);
+        if (first.ec != std::errc() || second.ec != std::errc())
+        {
+            std::cerr << "Skipping malformed query line: " << line << std::endl;
+            continue;
+        }
+        queries.push_back({x1, x2});
+    }
+    return sawInput && !queries.empty();
+}
+
+inline bool writeTextResults(int fd, const QueryResults &results)
+{
+    std::string out;
+    char number[16];
+    for (size_t q = 0; q < results.size(); ++q)
+    {
+        RowSpan rows = results[q];
+        out.append(number, std::to_chars(number, number + sizeof(number), rows.size()).ptr);
+        for (int row : rows)
+        {
+            out.push_back(' ');
+            out.append(number, std::to_chars(number, number + sizeof(number), row).ptr);
+        }
+        out.push_back('\n');
+    }
+    out.push_back('\n');
+    return writeAll(fd, out.data(), out.size());
+}
+
+// Largest numQueries a binary batch header may announce, so a bad header
+// cannot make the server allocate without bound
+static const uint32_t kMaxBinaryBatchQueries = 1 << 24;
+
+// Reads the next binary batch. Returns false at end of stream or on a bad
+// header.
+inline bool readBinaryBatch(FdReader &reader, std::vector<std::pair<int, int>> &queries, bool &nonOverlapping)
+{
+    uint32_t header[2];
+    if (!reader.readExact(header, sizeof(header)) || header[0] == 0)
+    {
+        return false;
+    }
+    if (header[0] > kMaxBinaryBatchQueries)
+    {
+        std::cerr << "Binary batch of " << header[0] << " queries exceeds the maximum of " << kMaxBinaryBatchQueries
+                  << ", closing stream" << std::endl;
+        return false;
+    }
+    nonOverlapping = (header[1] & 1) != 0;
+
+    std::vector<int32_t> bounds(2 * static_cast<size_t>(header[0]));
+    if (!reader.readExact(bounds.data(), bounds.size() * sizeof(int32_t)))
+    {
+        std::cerr << "Truncated binary batch" << std::endl;
+        return false;
+    }
+    queries.resize(header[0]);
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        queries[i] = {bounds[2 * i], bounds[2 * i + 1]};
+    }
+    return true;
+}
+
+inline bool writeBinaryResults(int fd, const QueryResults &results)
+{
+    std::vector<uint32_t> header(1 + results.size());
+    header[0] = static_cast<uint32_t>(results.size());
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        header[1 + i] = static_cast<uint32_t>(results[i].size());
+    }
+    if (!writeAll(fd, header.data(), header.size() * sizeof(uint32_t)))
+    {
+        return false;
+    }
+    // The rows are already laid out query by query
+    return results.totalRows() == 0 || writeAll(fd, results.rows.data(), results.totalRows() * sizeof(int));
+}
+
+inline bool writeTextAggregates(int fd, const std::vector<AggregateResult> &results)
+{
+    std::string out;
+    char number[24];
+    for (const auto &result : results)
+    {
+        out.append(number, std::to_chars(number, number + sizeof(number), result.count).ptr);
+        out.push_back(' ');
+        out.append(number, std::to_chars(number, number + sizeof(number), result.sum).ptr);
+        out.push_back(' ');
+        out.append(number, std::to_chars(number, number + sizeof(number), result.min).ptr);
+        out.push_back(' ');
+        out.append(number, std::to_chars(number, number + sizeof(number), result.max).ptr);
+        out.push_back('\n');
+    }
+    out.push_back('\n');
+    return writeAll(fd, out.data(), out.size());
+}
+
+inline bool writeBinaryAggregates(int fd, const std::vector<AggregateResult> &results)
+{
+    const size_t recordSize = 2 * sizeof(int64_t) + 2 * sizeof(int32_t);
+    std::vector<char> out(sizeof(uint32_t) + results.size() * recordSize);
+    uint32_t numQueries = static_cast<uint32_t>(results.size());
+    std::memcpy(out.data(), &numQueries, sizeof(numQueries));
+    char *p = out.data() + sizeof(numQueries);
+    for (const auto &result : results)
+    {
+        std::memcpy(p, &result.count, sizeof(int64_t));
+        std::memcpy(p + 8, &result.sum, sizeof(int64_t));
+        std::memcpy(p + 16, &result.min, sizeof(int32_t));
+        std::memcpy(p + 20, &result.max, sizeof(int32_t));
+        p += recordSize;
+    }
+    return writeAll(fd, out.data(), out.size());
+}
+
+// Responds with the row identifiers of each query.
+inline BatchResponder rowResponder(bool binary, const BatchHandler &handler)
+{
+    return [binary, handler](int outFd, const std::vector<std::pair<int, int>> &queries, bool nonOverlapping, size_t &rows) {
+        const QueryResults &results = handler(queries, nonOverlapping);
+        rows = results.totalRows();
+        return binary ? writeBinaryResults(outFd, results) : writeTextResults(outFd, results);
+    };
+}
+
+// Responds with the aggregates of each query.
+inline BatchResponder aggregateResponder(bool binary, const AggregateHandler &handler)
+{
+    return [binary, handler](int outFd, const std::vector<std::pair<int, int>> &queries, bool nonOverlapping, size_t &rows) {
+        std::vector<AggregateResult> results = handler(queries, nonOverlapping);
+        rows = 0;
+        for (const auto &result : results)
+        {
+            rows += result.count;
+        }
+        return binary ? writeBinaryAggregates(outFd, results) : writeTextAggregates(outFd, results);
+    };
+}
+
+// Serves batches from inFd until end of input, writing responses to outFd.
+// Returns the number of batches answered.
+inline size_t serveStream(int inFd, int outFd, bool binary, bool nonOverlapping, const BatchResponder &responder,
+                          const StreamFinisher &finisher = nullptr)
+{
+    FdReader reader(inFd);
+    std::vector<std::pair<int, int>> queries;
+    size_t batches = 0;
+    while (true)
+    {
+        bool batchNonOverlapping = nonOverlapping;
+        bool haveBatch = binary ? readBinaryBatch(reader, queries, batchNonOverlapping)
+                                : readTextBatch(reader, queries);
+        if (!haveBatch)
+        {
+            break;
+        }
+
+        std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+        size_t rows = 0;
+        bool written = responder(outFd, queries, batchNonOverlapping, rows);
+        std::chrono::high_resolution_clock::time_point endTime = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double, std::milli> elapsed = endTime - startTime;
+
+        std::cerr << "batch " << batches << ": " << queries.size() << " queries, " << rows
+                  << " rows, batch_time: " << elapsed.count() << " ms" << std::endl;
+        ++batches;
+        if (!written)
+        {
+            std::cerr << "Failed to write results, closing stream" << std::endl;
+            break;
+        }
+    }
+    if (finisher && !finisher())
+    {
+        std::cerr << "Failed to write results" << std::endl;
+    }
+    return batches;
+}
+
+// Serves batches from source: "-" for stdin, "unix:<path>" for a UNIX domain
+// socket (connections are served one after another, forever), otherwise a
+// query file. Responses go to stdout, or back over the socket.
+inline int serveQueries(const std::string &source, bool binary, bool nonOverlapping, const BatchResponder &responder,
+                        const StreamFinisher &finisher = nullptr)
+{
+    if (source == "-")
+    {
+        serveStream(STDIN_FILENO, STDOUT_FILENO, binary, nonOverlapping, responder, finisher);
+        return 0;
+    }
+
+    const std::string socketPrefix = "unix:";
+    if (source.compare(0, socketPrefix.size(), socketPrefix) != 0)
+    {
+        int fd = ::open(source.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Failed to open query file: " << source << std::endl;
+            return -1;
+        }
+        serveStream(fd, STDOUT_FILENO, binary, nonOverlapping, responder, finisher);
+        ::close(fd);
+        return 0;
+    }
+
+    std::string path = source.substr(socketPrefix.size());
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Invalid socket path: " << path << std::endl;
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+
+    int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+    {
+        std::cerr << "Failed to create socket" << std::endl;
+        return -1;
+    }
+    ::unlink(path.c_str());
+    if (::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listenFd, 16) != 0)
+    {
+        std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(listenFd);
+        return -1;
+    }
+    // A client hanging up mid-response must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+    std::cerr << "listening on " << path << std::endl;
+
+    while (true)
+    {
+        int clientFd = ::accept(listenFd, nullptr, nullptr);
+        if (clientFd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        serveStream(clientFd, clientFd, binary, nonOverlapping, responder, finisher);
+        ::close(clientFd);
+    }
+    ::close(listenFd);
+    ::unlink(path.c_str());
+    return -1;
+}
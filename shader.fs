@@ -1,13 +1,30 @@
-#version 460
+#version 430
+#extension GL_ARB_shader_atomic_counter_ops : require
+// Defined by the host (which then compiles this as #version 450) when the
+// GPU has subgroup arithmetic and ballot in fragment shaders: output space
+// is then reserved once per subgroup
+#ifdef SUBGROUP_ALLOCATION
+#extension GL_KHR_shader_subgroup_arithmetic : require
+#extension GL_KHR_shader_subgroup_ballot : require
+#endif
 
 out vec4 FragColor;
 
-uniform isamplerBuffer dataTextureBuffer;
+uniform isamplerBuffer keyOffsetsBuffer; // CSR offsets into rowIdsBuffer per key
+uniform isamplerBuffer rowIdsBuffer;     // Row identifiers grouped by key
+uniform isamplerBuffer keyEndsBuffer;    // Updatable tiles: end of each key's rows
+uniform bool hasKeyEnds; // Else a key's rows end where the next key's begin
+uniform isamplerBuffer payloadBuffer;    // Payload value of each rowIdsBuffer entry
+uniform bool hasPayload;
 uniform float range_min;
 uniform float range_max;
 uniform int textureSize;
 uniform int viewportWidth;
 uniform bool screen;
+uniform bool countOnly; // Counting pass: only add to the counter
+uniform bool aggregate; // Fold rows into the per-subquery aggregates instead
+uniform bool ordered;   // Write rows to rank-derived slots instead of reserving
+uniform int tileRowBase; // Rank of the tile's first row
 
 struct ResultData {
     int queryIndex;
@@ -20,10 +37,37 @@ layout(std430, binding = 0) buffer MySSBO {
 
 layout(binding = 1, offset = 0) uniform atomic_uint atomicCounter;
 
+// Ordered mode: output slot of the row at rank r (tile relative: r =
+// tileRowBase + rowBegin) of subquery s is outputBias[s] + r
+layout(std430, binding = 4) readonly buffer OutputBiasSSBO {
+    int outputBias[];
+};
+
+// One per subquery. The 64-bit sum is kept as two words; the carry out of
+// sumLow is added to sumHigh.
+struct QueryAggregate {
+    uint count;
+    uint sumLow;
+    uint sumHigh;
+    int minValue;
+    int maxValue;
+};
+
+layout(std430, binding = 2) buffer AggregateSSBO {
+    QueryAggregate aggregates[];
+};
+
 flat in int fs_queryIndex;
 
 void main() {
     // Reconstruct orig_data_x from gl_FragCoord.x
+#ifdef SUBGROUP_ALLOCATION
+    // Helper invocations must not take part in the reservation: their
+    // atomics have no effect
+    if (gl_HelperInvocation) {
+        discard;
+    }
+#endif
     float x_coord = gl_FragCoord.x;
     float y_coord = screen ? gl_FragCoord.y - 1 : gl_FragCoord.y;
 
@@ -39,20 +83,73 @@ void main() {
         return;
     }
 
-    int rowIdentifier = texelFetch(dataTextureBuffer, index).r;
+    int rowBegin = texelFetch(keyOffsetsBuffer, index).r;
+    int rowEnd = hasKeyEnds ? texelFetch(keyEndsBuffer, index).r : texelFetch(keyOffsetsBuffer, index + 1).r;
 
-    if (rowIdentifier == -1) {
+    if (rowBegin == rowEnd) {
         discard; // No data point at this position
     } else {
-        // Output the fragment and use the rowIdentifier for further processing
+        // Output the fragment and emit every row with this key
         FragColor = vec4(1.0, 0.0, 0.0, 1.0); // For visualization
 
-        // Atomically increment the counter and get a unique index
-        uint dataIndex = atomicCounterIncrement(atomicCounter);
-
-        // Write the queryIndex and rowIdentifier into the SSBO
-        data[dataIndex].queryIndex = fs_queryIndex;
-        data[dataIndex].rowIdentifier = rowIdentifier;
+        if (aggregate) {
+            // Fold the key's rows locally, then publish with one atomic per field
+            atomicAdd(aggregates[fs_queryIndex].count, uint(rowEnd - rowBegin));
+            if (!hasPayload) {
+                return;
+            }
+            uint sumLow = 0u;
+            uint sumHigh = 0u;
+            int minValue = 2147483647;
+            int maxValue = -2147483647 - 1;
+            for (int row = rowBegin; row < rowEnd; ++row) {
+                int value = texelFetch(payloadBuffer, row).r;
+                uint carry;
+                sumLow = uaddCarry(sumLow, uint(value), carry);
+                sumHigh += carry + (value < 0 ? 0xFFFFFFFFu : 0u);
+                minValue = min(minValue, value);
+                maxValue = max(maxValue, value);
+            }
+            uint previousLow = atomicAdd(aggregates[fs_queryIndex].sumLow, sumLow);
+            uint carry = previousLow + sumLow < previousLow ? 1u : 0u;
+            atomicAdd(aggregates[fs_queryIndex].sumHigh, sumHigh + carry);
+            atomicMin(aggregates[fs_queryIndex].minValue, minValue);
+            atomicMax(aggregates[fs_queryIndex].maxValue, maxValue);
+            return;
+        }
+
+        uint dataIndex;
+        if (ordered) {
+            // Rank-derived slot: rows land in key order, no atomics
+            dataIndex = uint(outputBias[fs_queryIndex] + tileRowBase + rowBegin);
+        } else {
+#ifdef SUBGROUP_ALLOCATION
+            // The first active lane reserves the rows of the whole subgroup
+            // with one atomic add; every lane writes at its exclusive prefix
+            uint rows = uint(rowEnd - rowBegin);
+            uint laneOffset = subgroupExclusiveAdd(rows);
+            uint subgroupRows = subgroupAdd(rows);
+            uint subgroupBase = 0u;
+            if (subgroupElect()) {
+                subgroupBase = atomicCounterAddARB(atomicCounter, subgroupRows);
+            }
+            dataIndex = subgroupBroadcastFirst(subgroupBase) + laneOffset;
+#else
+            // Reserve one slot per row with a single atomic add
+            dataIndex = atomicCounterAddARB(atomicCounter, uint(rowEnd - rowBegin));
+#endif
+        }
+        if (countOnly) {
+            return;
+        }
+
+        // Write the queryIndex and rowIdentifiers into the SSBO; rows past
+        // its end are dropped and the host retries with a larger buffer
+        uint dataEnd = min(dataIndex + uint(rowEnd - rowBegin), uint(data.length()));
+        for (int row = rowBegin; dataIndex < dataEnd; ++row, ++dataIndex) {
+            data[dataIndex].queryIndex = fs_queryIndex;
+            data[dataIndex].rowIdentifier = texelFetch(rowIdsBuffer, row).r;
+        }
     }
 }
 
@@ -1,4 +1,4 @@
-#version 460
+#version 430
 
 layout(location = 0) in float data_x;
 layout(location = 1) in float data_y;
@@ -0,0 +1,86 @@
+#version 430
+#extension GL_ARB_shader_atomic_counter_ops : require
+
+// KKIndex2D: every fragment is one grid cell covered by a query rectangle.
+// It emits the rows of the cell that lie in the rectangle: all of them if
+// the cell is inside it, else those whose keys pass the test.
+
+out vec4 FragColor;
+
+uniform isamplerBuffer cellOffsetsBuffer; // CSR offsets into rowIdsBuffer per cell index
+uniform isamplerBuffer rowIdsBuffer;      // Row identifiers grouped by cell
+uniform isamplerBuffer rowKeysBuffer;     // (x, y) keys of each rowIdsBuffer entry, relative
+uniform ivec2 gridSize;
+uniform uvec2 cellShift; // A cell covers 2^cellShift keys per axis
+uniform bool zOrder;     // Cells are numbered in Morton order, else row-major
+uniform bool countOnly;  // Counting pass: only add to the counter
+
+struct ResultData {
+    int queryIndex;
+    int rowIdentifier;
+};
+
+layout(std430, binding = 0) buffer MySSBO {
+    ResultData data[];
+};
+
+layout(binding = 1, offset = 0) uniform atomic_uint atomicCounter;
+
+flat in int fs_queryIndex;
+flat in uvec4 fs_rect; // x1, x2, y1, y2
+
+// Spreads the low 16 bits over the even bits, as spreadBits() in kk_index_2d.h
+uint spreadBits(uint v) {
+    v &= 0xFFFFu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+bool inRect(uvec2 key) {
+    return key.x >= fs_rect.x && key.x < fs_rect.y && key.y >= fs_rect.z && key.y < fs_rect.w;
+}
+
+void main() {
+    uvec2 cell = uvec2(gl_FragCoord.xy);
+    if (cell.x >= uint(gridSize.x) || cell.y >= uint(gridSize.y)) {
+        discard;
+    }
+    int cellIndex = int(zOrder ? spreadBits(cell.x) | (spreadBits(cell.y) << 1) : cell.y * uint(gridSize.x) + cell.x);
+    int rowBegin = texelFetch(cellOffsetsBuffer, cellIndex).r;
+    int rowEnd = texelFetch(cellOffsetsBuffer, cellIndex + 1).r;
+    if (rowBegin == rowEnd) {
+        discard; // No rows in this cell
+    }
+    FragColor = vec4(1.0, 0.0, 0.0, 1.0); // For visualization
+
+    // First and last key of the cell; no overflow even for the last cell
+    uvec2 cellFirst = cell << cellShift;
+    uvec2 cellLast = cellFirst + ((uvec2(1u) << cellShift) - 1u);
+    bool inside = inRect(cellFirst) && inRect(cellLast);
+
+    uint rows = 0u;
+    if (inside) {
+        rows = uint(rowEnd - rowBegin);
+    } else {
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            rows += inRect(uvec2(texelFetch(rowKeysBuffer, row).rg)) ? 1u : 0u;
+        }
+    }
+    if (rows == 0u) {
+        return;
+    }
+    uint dataIndex = atomicCounterAddARB(atomicCounter, rows);
+    if (countOnly) {
+        return;
+    }
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        if (inside || inRect(uvec2(texelFetch(rowKeysBuffer, row).rg))) {
+            data[dataIndex].queryIndex = fs_queryIndex;
+            data[dataIndex].rowIdentifier = texelFetch(rowIdsBuffer, row).r;
+            ++dataIndex;
+        }
+    }
+}
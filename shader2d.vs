@@ -0,0 +1,17 @@
+#version 430
+
+// KKIndex2D: one corner of a query rectangle, in cell coordinates
+layout(location = 0) in vec2 position;
+layout(location = 1) in int queryIndex;
+layout(location = 2) in uvec4 rect; // Query x1, x2, y1, y2, relative to the grid minima
+
+uniform mat4 projectionMatrix;
+
+flat out int fs_queryIndex;
+flat out uvec4 fs_rect;
+
+void main() {
+    gl_Position = projectionMatrix * vec4(position, 0.0, 1.0);
+    fs_queryIndex = queryIndex;
+    fs_rect = rect;
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+// Parallel loader for '|'-delimited dbgen tables (.tbl).
+//
+// The file is mmap'ed and split into one chunk per worker thread at newline
+// boundaries. A first parallel pass counts the rows of every chunk, a prefix
+// sum over those counts gives each chunk its first row identifier, and a
+// second parallel pass parses the requested columns straight into
+// structure-of-arrays int32 columns. '|' and '\n' are located with SSE2/AVX2
+// compares where available.
+//
+// Field values are parsed as int32:
+//   integers          as-is              ("155190"     -> 155190)
+//   DECIMAL(15,2)     in hundredths      ("21168.23"   -> 2116823)
+//   DATE              as yyyymmdd        ("1996-03-13" -> 19960313)
+// Both encodings preserve order, so range queries on them stay meaningful.
+// Any other text parses to 0.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+struct ColumnTable
+{
+    std::vector<int> columnIndices;        // .tbl column of each loaded column
+    std::vector<std::vector<int>> columns; // columns[i][row]
+    size_t numRows = 0;
+
+    const int *column(size_t i) const { return columns[i].data(); }
+};
+
+// Returns the first '|' or '\n' in [p, end), or end.
+inline const char *findFieldDelimiter(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+    const __m256i pipe = _mm256_set1_epi8('|');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, pipe), _mm256_cmpeq_epi8(bytes, newline))));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, pipe), _mm_cmpeq_epi8(bytes, newline))));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p < end; ++p)
+    {
+        if (*p == '|' || *p == '\n')
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+// Counts the non-empty lines in [begin, end). begin must be the start of a
+// line; a last line without a trailing '\n' is counted too.
+inline size_t countTableRows(const char *begin, const char *end)
+{
+    size_t rows = 0;
+    const char *p = begin;
+    // A '\n' ends a row unless the byte before it is also a '\n' (blank line).
+    // begin is preceded by a newline (or the start of the file).
+    unsigned carry = 1;
+#if defined(__AVX2__)
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+        uint32_t previous = (mask << 1) | carry;
+        rows += __builtin_popcount(mask & ~previous);
+        carry = mask >> 31;
+    }
+#elif defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+        uint32_t previous = ((mask << 1) | carry) & 0xFFFF;
+        rows += __builtin_popcount(mask & ~previous);
+        carry = mask >> 15;
+    }
+#endif
+    for (; p < end; ++p)
+    {
+        unsigned isNewline = (*p == '\n');
+        rows += isNewline & ~carry;
+        carry = isNewline;
+    }
+    if (end > begin && end[-1] != '\n')
+    {
+        rows++;
+    }
+    return rows;
+}
+
+// Parses one field (see the encodings at the top of this file).
+inline int parseTableField(const char *p, const char *end)
+{
+    bool negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        ++p;
+    }
+
+    const char *digitsBegin = p;
+    int value = 0;
+    while (p < end && static_cast<unsigned>(*p - '0') < 10)
+    {
+        value = value * 10 + (*p++ - '0');
+    }
+
+    if (p < end && *p == '.')
+    {
+        // DECIMAL(15,2): keep two fractional digits.
+        ++p;
+        for (int digit = 0; digit < 2; ++digit)
+        {
+            value *= 10;
+            if (p < end && static_cast<unsigned>(*p - '0') < 10)
+            {
+                value += *p++ - '0';
+            }
+        }
+    }
+    else if (!negative && p - digitsBegin == 4 && end - digitsBegin == 10 && *p == '-' && digitsBegin[7] == '-')
+    {
+        // DATE: yyyy-mm-dd
+        int month = (digitsBegin[5] - '0') * 10 + (digitsBegin[6] - '0');
+        int day = (digitsBegin[8] - '0') * 10 + (digitsBegin[9] - '0');
+        value = value * 10000 + month * 100 + day;
+    }
+    return negative ? -value : value;
+}
+
+// Parses the rows of [begin, end) into the columns starting at firstRow.
+// columnSlot[field] is the output column of a .tbl field, or -1.
+inline void parseTableChunk(const char *begin, const char *end, size_t firstRow,
+                            const std::vector<int> &columnSlot, std::vector<std::vector<int>> &columns)
+{
+    const int lastField = static_cast<int>(columnSlot.size()) - 1;
+    size_t row = firstRow;
+    const char *p = begin;
+    while (p < end)
+    {
+        if (*p == '\n')
+        {
+            ++p; // Blank line
+            continue;
+        }
+
+        int field = 0;
+        const char *fieldEnd = p;
+        while (field <= lastField)
+        {
+            fieldEnd = findFieldDelimiter(p, end);
+            int slot = columnSlot[field];
+            if (slot >= 0)
+            {
+                columns[slot][row] = parseTableField(p, fieldEnd);
+            }
+            ++field;
+            if (fieldEnd == end || *fieldEnd == '\n')
+            {
+                break;
+            }
+            p = fieldEnd + 1;
+        }
+        // Missing trailing fields parse as 0.
+        for (; field <= lastField; ++field)
+        {
+            if (columnSlot[field] >= 0)
+            {
+                columns[columnSlot[field]][row] = 0;
+            }
+        }
+
+        const char *lineEnd = (fieldEnd < end && *fieldEnd == '\n')
+                                  ? fieldEnd
+                                  : static_cast<const char *>(std::memchr(fieldEnd, '\n', end - fieldEnd));
+        p = lineEnd ? lineEnd + 1 : end;
+        ++row;
+    }
+}
+
+// Loads the given columns of a .tbl file with numThreads workers (0 means one
+// per hardware thread). Row identifiers are the positions of the non-empty
+// lines in the file.
+inline ColumnTable loadTableParallel(const char *filename, const std::vector<int> &columnIndices, int numThreads = 0)
+{
+    ColumnTable table;
+    table.columnIndices = columnIndices;
+    table.columns.resize(columnIndices.size());
+
+    int maxColumn = -1;
+    for (int columnIndex : columnIndices)
+    {
+        if (columnIndex < 0)
+        {
+            std::cerr << "Invalid column index: " << columnIndex << std::endl;
+            return table;
+        }
+        maxColumn = std::max(maxColumn, columnIndex);
+    }
+    std::vector<int> columnSlot(maxColumn + 1, -1);
+    for (size_t i = 0; i < columnIndices.size(); ++i)
+    {
+        if (columnSlot[columnIndices[i]] >= 0)
+        {
+            std::cerr << "Column " << columnIndices[i] << " requested twice" << std::endl;
+            return table;
+        }
+        columnSlot[columnIndices[i]] = static_cast<int>(i);
+    }
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open file: " << filename << std::endl;
+        return table;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return table;
+    }
+    size_t fileSize = st.st_size;
+    void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::cerr << "Failed to mmap file: " << filename << std::endl;
+        return table;
+    }
+    madvise(mapped, fileSize, MADV_SEQUENTIAL);
+    const char *data = static_cast<const char *>(mapped);
+    const char *dataEnd = data + fileSize;
+
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Keep chunks large enough that thread start-up does not dominate.
+    const size_t minChunkBytes = 1 << 20;
+    numThreads = static_cast<int>(std::max<size_t>(1, std::min<size_t>(numThreads, fileSize / minChunkBytes)));
+
+    // Split at newline boundaries.
+    std::vector<const char *> chunkBegin(numThreads + 1);
+    chunkBegin[0] = data;
+    for (int t = 1; t < numThreads; ++t)
+    {
+        const char *split = std::max(chunkBegin[t - 1], data + fileSize * t / numThreads);
+        const char *newline = static_cast<const char *>(std::memchr(split, '\n', dataEnd - split));
+        chunkBegin[t] = newline ? newline + 1 : dataEnd;
+    }
+    chunkBegin[numThreads] = dataEnd;
+
+    std::vector<size_t> chunkRows(numThreads + 1, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        workers.emplace_back([&, t]() { chunkRows[t + 1] = countTableRows(chunkBegin[t], chunkBegin[t + 1]); });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+
+    // chunkRows[t] becomes the first row identifier of chunk t.
+    for (int t = 1; t <= numThreads; ++t)
+    {
+        chunkRows[t] += chunkRows[t - 1];
+    }
+    table.numRows = chunkRows[numThreads];
+    for (auto &column : table.columns)
+    {
+        column.resize(table.numRows);
+    }
+
+    for (int t = 0; t < numThreads; ++t)
+    {
+        workers.emplace_back([&, t]() { parseTableChunk(chunkBegin[t], chunkBegin[t + 1], chunkRows[t], columnSlot, table.columns); });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    munmap(mapped, fileSize);
+    return table;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// The key column (and an optional payload column) of a table, from either a
+// .kkcol file, mapped in place, or a .tbl file, parsed in parallel. Every
+// index backend indexes the columns of one TableSource.
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "column_table.h"
+#include "metrics.h"
+#include "table_loader.h"
+
+struct TableSource
+{
+    ColumnTable table;             // Columns parsed from a .tbl file
+    MappedColumnTable columnTable; // Columns mapped in place from a .kkcol file
+    const int *keys = nullptr;     // Key of each row, indexed by row identifier
+    const int *payload = nullptr;  // Optional payload column for SUM/MIN/MAX
+    size_t numRows = 0;
+
+    // Loads the key column (column 0) and, if payloadColumn >= 0, the payload
+    // column. Returns false if no rows were loaded.
+    bool load(const char *filename, int payloadColumn = -1)
+    {
+        StageTimer timer("table_load_time");
+        this->keys = nullptr;
+        this->payload = nullptr;
+        this->numRows = 0;
+        if (isColumnTableFile(filename))
+        {
+            // Use the mapped key column directly, no parsing or copying.
+            if (this->columnTable.open(filename))
+            {
+                this->keys = this->columnTable.column(0);
+                this->numRows = this->columnTable.numRows();
+                if (payloadColumn >= 0)
+                {
+                    this->payload = this->columnTable.findSourceColumn(payloadColumn);
+                }
+            }
+        }
+        else
+        {
+            std::vector<int> columnIndices = {0};
+            if (payloadColumn > 0)
+            {
+                columnIndices.push_back(payloadColumn);
+            }
+            this->table = loadTableParallel(filename, columnIndices);
+            if (this->table.numRows > 0)
+            {
+                this->keys = this->table.column(0);
+                this->numRows = this->table.numRows;
+                if (payloadColumn >= 0)
+                {
+                    this->payload = this->table.column(columnIndices.size() - 1);
+                }
+            }
+        }
+        if (payloadColumn >= 0 && !this->payload)
+        {
+            std::cerr << "Payload column " << payloadColumn << " is not available in " << filename << std::endl;
+        }
+        std::cout << "rows: " << this->numRows << std::endl;
+        timer.stop();
+        return this->numRows > 0;
+    }
+};